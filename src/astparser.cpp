@@ -5,34 +5,140 @@
 #include "helpers.h"
 #include "interpreter.h"
 #include "mymemory.h"
+#include "optimizer.h"
+#include "resolver.h"
+#include "scanner.h"
 
+#include <assert.h>
+
+
+// Tokens are pulled from the scanner on demand, only the last few are kept.
+static constexpr u32 ParserLookahead = 4;
+// Expr::argCount is 16 bits.
+static constexpr u32 MaxCallArgs = 0xffff;
 
 struct Parser
 {
     MyMemory& mem;
+    Scanner& scanner;
     i32 currentPos;
+    // Token i lives in lookahead[i % ParserLookahead] while i is one of the
+    // last ParserLookahead scanned tokens.
+    Token lookahead[ParserLookahead];
+    u32 scannedCount;
+    // Arguments of the calls being parsed, nested calls stack on top. A call
+    // moves its finished arguments into mem.callArgs in one contiguous range.
+    std::vector<u32> argStack;
+    // Skip function bodies by brace matching, see ast_parseFunction().
+    bool lazyBodies;
+    // Skipped bodies declaring functions of their own, those must be known
+    // before the resolver runs.
+    std::vector<u32> nestedFnBodies;
+    // Prompt input reports a parse error and gives up on the input instead of
+    // exiting, see parseError().
+    bool recoverErrors;
+    bool hasErrors;
+};
+
+enum Precedence : u8
+{
+    Precedence_None,
+    Precedence_Assignment,
+    Precedence_Or,
+    Precedence_And,
+    Precedence_Equality,
+    Precedence_Comparison,
+    Precedence_Term,
+    Precedence_Factor,
+    Precedence_Unary,
+    Precedence_Call,
 };
 
+// How a token continues an expression when it follows an operand.
+struct InfixRule
+{
+    Precedence precedence;
+    ExprType exprType;
+};
+
+struct InfixRuleTable
+{
+    InfixRule rules[(u32)TokenType::END_OF_FILE + 1];
+};
+
+// Adding a binary operator is one line here plus its evaluation.
+static consteval InfixRuleTable makeInfixRules()
+{
+    InfixRuleTable table{};
+    auto set = [&table](TokenType type, Precedence precedence, ExprType exprType)
+    {
+        table.rules[(u32)type] = InfixRule{ .precedence = precedence, .exprType = exprType };
+    };
+    set(TokenType::EQUAL, Precedence_Assignment, ExprType_Assign);
+    set(TokenType::OR, Precedence_Or, ExprType_Logical);
+    set(TokenType::AND, Precedence_And, ExprType_Logical);
+    set(TokenType::BANG_EQUAL, Precedence_Equality, ExprType_Binary);
+    set(TokenType::EQUAL_EQUAL, Precedence_Equality, ExprType_Binary);
+    set(TokenType::GREATER, Precedence_Comparison, ExprType_Binary);
+    set(TokenType::GREATER_EQUAL, Precedence_Comparison, ExprType_Binary);
+    set(TokenType::LESSER, Precedence_Comparison, ExprType_Binary);
+    set(TokenType::LESSER_EQUAL, Precedence_Comparison, ExprType_Binary);
+    set(TokenType::MINUS, Precedence_Term, ExprType_Binary);
+    set(TokenType::PLUS, Precedence_Term, ExprType_Binary);
+    set(TokenType::SLASH, Precedence_Factor, ExprType_Binary);
+    set(TokenType::STAR, Precedence_Factor, ExprType_Binary);
+    set(TokenType::LEFT_PAREN, Precedence_Call, ExprType_CallFn);
+    return table;
+}
+
+static constexpr InfixRuleTable infixRules = makeInfixRules();
+
 static u32 expression(Parser& parser);
+static u32 parsePrecedence(Parser& parser, Precedence precedence);
 static u32 declaration(Parser& parser);
 static i32 block(Parser& parser, i32 parentBlockIndex);
+static bool skipBody(Parser& parser);
 
 
-static const Token LastToken{.type = TokenType::END_OF_FILE };
-static const Token& peek(const Parser& parser)
+static const Token& tokenAt(Parser& parser, u32 index)
+{
+    while (parser.scannedCount <= index)
+    {
+        Token token;
+        u32 tokenIndex = scanner_next(parser.scanner, token);
+        if (tokenIndex < parser.scannedCount)
+        {
+            // Past the end, the scanner repeats END_OF_FILE.
+            return parser.lookahead[tokenIndex % ParserLookahead];
+        }
+        parser.lookahead[parser.scannedCount % ParserLookahead] = token;
+        parser.scannedCount++;
+    }
+    assert(index + ParserLookahead >= parser.scannedCount);
+    return parser.lookahead[index % ParserLookahead];
+}
+
+static TokenType peekType(Parser& parser)
 {
-    if (parser.currentPos >= parser.mem.tokens.size())
+    // After a recovered error the rest of the input reads as its end, every
+    // loop of the parser stops there.
+    if(parser.hasErrors)
     {
-        return LastToken;
+        return TokenType::END_OF_FILE;
     }
-    return parser.mem.tokens[parser.currentPos];
+    return tokenAt(parser, parser.currentPos).type;
 }
 
-static const Token& previous(const Parser& parser)
+static const Token& peek(Parser& parser)
+{
+    return tokenAt(parser, parser.currentPos);
+}
+
+static const Token& previous(Parser& parser)
 {
     i32 prevIndex = parser.currentPos - 1;
     prevIndex = prevIndex >= 0 ? prevIndex : 0;
-    return parser.mem.tokens[prevIndex];
+    return tokenAt(parser, prevIndex);
 }
 
 static const u32 previousIndex(const Parser& parser)
@@ -42,29 +148,28 @@ static const u32 previousIndex(const Parser& parser)
     return prevIndex;
 }
 
-static bool isAtEnd(const Parser& parser)
+static bool isAtEnd(Parser& parser)
 {
-    return peek(parser).type == TokenType::END_OF_FILE;
+    return peekType(parser) == TokenType::END_OF_FILE;
 }
 
-static const Token& advance(Parser& parser)
+static void advance(Parser& parser)
 {
     if (!isAtEnd(parser))
     {
         parser.currentPos++;
     }
-    return previous(parser);
 }
 
 
 
-static bool check(const Parser& parser, TokenType type)
+static bool check(Parser& parser, TokenType type)
 {
     if (isAtEnd(parser))
     {
         return false;
     }
-    return peek(parser).type == type;
+    return peekType(parser) == type;
 }
 
 
@@ -142,302 +247,205 @@ static bool parenthesize(const MyMemory& mem, const std::string& name, u32 exprI
     return result;
 }
 
-static const Token& consume(Parser& parser, TokenType type, const std::string& message)
+static void parseError(Parser& parser, const Token& token, const std::string& message, i32 exitCode)
 {
-    if(check(parser, type))
-    {
-        return advance(parser);
-    }
-
-    reportError(parser.mem, peek(parser), message);
-    // TODO FIX THIS!
-    DEBUG_BREAK_MACRO(-1);
-}
-
-static u32 primary(Parser& parser)
-{
-    if(match(parser, TokenType::FALSE))
-        return addExpr(parser.mem, { .exprValue = {.value = 0, .literalType = LiteralType_Boolean }, .exprType = ExprType_Literal,  });
-    if(match(parser, TokenType::TRUE))
-        return addExpr(parser.mem, { .exprValue = { .value = ~(i64(0)), .literalType = LiteralType_Boolean }, .exprType = ExprType_Literal,  });
-    if(match(parser, TokenType::NIL))
-        return addExpr(parser.mem, { .exprValue = { .value = 0, .literalType = LiteralType_Null}, .exprType = ExprType_Literal,  });
-    if(match(parser, TokenType::IDENTIFIER))
-    {
-        const Token& prevToken = previous(parser);
-        //const ExprValue& value = getConstValue(parser.mem, prevToken);
-        return addExpr(parser.mem, { .exprValue = prevToken.value, .exprType = ExprType_Variable });
-//                       { .exprValue = prevToken.value, .exprType = ExprType_Literal, });
-    }
-    if(match(parser, TokenType::STRING))
+    // Only the first error of an input is meaningful, the rest follow from it.
+    if(!parser.hasErrors)
     {
-        const Token& prevToken = previous(parser);
-        return addExpr(parser.mem,
-            { .exprValue = { .value = prevToken.value.value, .literalType = LiteralType_String }, .exprType = ExprType_Literal,  });
+        reportError(parser.mem, token, message);
     }
-    if(match(parser, TokenType::NUMBER))
+    parser.hasErrors = true;
+    if(!parser.recoverErrors)
     {
-        const Token& prevToken = previous(parser);
-        Expr newExpr = { .exprValue = { .value = prevToken.value.value, .literalType = LiteralType_Double }, .exprType = ExprType_Literal,};
-        return addExpr(parser.mem, newExpr);
+        DEBUG_BREAK_MACRO(exitCode);
     }
-    if(match(parser, TokenType::INTEGER))
-    {
-        const Token& prevToken = previous(parser);
-        Expr newExpr = { .exprValue = { .value = prevToken.value.value, .literalType = LiteralType_I64 }, .exprType = ExprType_Literal,};
-        return addExpr(parser.mem, newExpr);
-    }
-    if(match(parser, TokenType::LEFT_PAREN))
-    {
-        u32 newExpr = expression(parser);
-        consume(parser, TokenType::RIGHT_PAREN, "Expect ')' after expression.");
-        return addExpr(parser.mem, parser.mem.expressions[newExpr]);
-    }
-
-    reportError(parser.mem, peek(parser), "No matching type for primary!\n");
-    DEBUG_BREAK_MACRO(-1);
 }
 
-static u32 finishCall(Parser& parser, u32 callee)
+static void consume(Parser& parser, TokenType type, const std::string& message)
 {
-    Expr expr {
-        .callee = callee,
-        .exprType = ExprType::ExprType_CallFn
-    };
-
-    u32 args = 0;
-    if(!check(parser, TokenType::RIGHT_PAREN))
+    if(check(parser, type))
     {
-        do
-        {
-            if(args == 4)
-            {
-                reportError(parser.mem, peek(parser), "Only 4 arguments are legal on fn call!\n");
-                DEBUG_BREAK_MACRO(-1);
-            }
-
-            u32 exprIndex = expression(parser);
-            expr.callParams[args] = exprIndex;
-            args++;
-        } while(match(parser, TokenType::COMMA));
-
+        advance(parser);
+        return;
     }
-    expr.callParamAmount = args;
-    //why do we need? const Token& token =
-    consume(parser, TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
-    u32 tokenIndex = parser.currentPos;
-    expr.tokenOperIndex = tokenIndex;
-    return addExpr(parser.mem, expr);
 
+    // TODO FIX THIS!
+    parseError(parser, peek(parser), message, -1);
 }
 
-static u32 callFn(Parser& parser)
+static u32 addLiteralExpr(Parser& parser, const ExprValue& value)
 {
-    u32 exprIndex = primary(parser);
-
-    while(match(parser, TokenType::LEFT_PAREN))
-    {
-        exprIndex = finishCall(parser, exprIndex);
-    }
-    return exprIndex;
+    return addExpr(parser.mem, { .literalIndex = addLiteral(parser.mem, value), .exprType = ExprType_Literal });
 }
 
-
-static u32 unary(Parser& parser)
+static u32 primary(Parser& parser)
 {
-    if(match(parser, TokenType::BANG, TokenType::MINUS))
-    {
-        u32 prevIndex = previousIndex(parser);
-        u32 rightIndex = unary(parser);
-
-        Expr expr{
-            .tokenOperIndex = prevIndex,
-            .rightExprIndex = rightIndex,
-            .exprType = ExprType_Unary
-        };
-
-        u32 exprIndex = addExpr(parser.mem, expr);
-        return exprIndex;
+    TokenType type = peekType(parser);
+    switch(type)
+    {
+        case TokenType::FALSE:
+            advance(parser);
+            return addLiteralExpr(parser, { .value = 0, .literalType = LiteralType_Boolean });
+        case TokenType::TRUE:
+            advance(parser);
+            return addLiteralExpr(parser, { .value = ~(i64(0)), .literalType = LiteralType_Boolean });
+        case TokenType::NIL:
+            advance(parser);
+            return addLiteralExpr(parser, { .value = 0, .literalType = LiteralType_Null });
+        case TokenType::IDENTIFIER:
+        {
+            advance(parser);
+            return addExpr(parser.mem, { .tokenOperIndex = previousIndex(parser), .exprType = ExprType_Variable });
+        }
+        case TokenType::STRING:
+        {
+            advance(parser);
+            const Token& prevToken = previous(parser);
+            // Literals become runtime strings, the token is only a view into the source.
+            u32 stringIndex = addString(parser.mem, std::string(getTokenLexeme(parser.mem, prevToken)));
+            return addLiteralExpr(parser, { .stringIndex = stringIndex, .literalType = LiteralType_String });
+        }
+        case TokenType::NUMBER:
+        {
+            advance(parser);
+            const Token& prevToken = previous(parser);
+            return addLiteralExpr(parser, { .value = prevToken.value.value, .literalType = LiteralType_Double });
+        }
+        case TokenType::INTEGER:
+        {
+            advance(parser);
+            const Token& prevToken = previous(parser);
+            return addLiteralExpr(parser, { .value = prevToken.value.value, .literalType = LiteralType_I64 });
+        }
+        case TokenType::LEFT_PAREN:
+        {
+            advance(parser);
+            u32 newExpr = expression(parser);
+            consume(parser, TokenType::RIGHT_PAREN, "Expect ')' after expression.");
+            // Parentheses only steer precedence, the inner expression stands for the group.
+            return newExpr;
+        }
+        default:
+            break;
     }
-    return callFn(parser);
-}
-
-
-static u32 factor(Parser& parser)
-{
-    u32 exprIndex = unary(parser);
-
-    while(match(parser, TokenType::SLASH, TokenType::STAR))
-    {
-        u32 prevIndex = previousIndex(parser);
-        u32 rightIndex = unary(parser);
 
-        Expr expr{
-            .tokenOperIndex = prevIndex,
-            .leftExprIndex = exprIndex,
-            .rightExprIndex = rightIndex,
-            .exprType = ExprType_Binary
-        };
-
-        exprIndex = addExpr(parser.mem, expr);
-
-    }
-    return exprIndex;
+    parseError(parser, peek(parser), "No matching type for primary!\n", -1);
+    return addLiteralExpr(parser, { .value = 0, .literalType = LiteralType_Null });
 }
 
-
-
-
-static u32 term(Parser& parser)
+static u32 finishCall(Parser& parser, u32 callee)
 {
-    u32 exprIndex = factor(parser);
-
-    while(match(parser, TokenType::MINUS, TokenType::PLUS))
+    u32 argsBase = parser.argStack.size();
+    if(!check(parser, TokenType::RIGHT_PAREN))
     {
-        u32 prevIndex = previousIndex(parser);
-        u32 rightIndex = factor(parser);
-
-        Expr expr{
-            .tokenOperIndex = prevIndex,
-            .leftExprIndex = exprIndex,
-            .rightExprIndex = rightIndex,
-            .exprType = ExprType_Binary
-        };
-
-        exprIndex = addExpr(parser.mem, expr);
-
+        do
+        {
+            u32 exprIndex = expression(parser);
+            parser.argStack.push_back(exprIndex);
+        } while(match(parser, TokenType::COMMA));
     }
-    return exprIndex;
-}
-
-static u32 comparison(Parser& parser)
-{
-    u32 exprIndex = term(parser);
-
-    while(match(parser, TokenType::GREATER, TokenType::GREATER_EQUAL, TokenType::LESSER, TokenType::LESSER_EQUAL))
+    u32 args = parser.argStack.size() - argsBase;
+    if(args > MaxCallArgs)
     {
-        u32 prevIndex = previousIndex(parser);
-        u32 rightIndex = term(parser);
-
-        Expr expr{
-            .tokenOperIndex = prevIndex,
-            .leftExprIndex = exprIndex,
-            .rightExprIndex = rightIndex,
-            .exprType = ExprType_Binary
-        };
-
-        exprIndex = addExpr(parser.mem, expr);
+        parseError(parser, peek(parser), "Too many arguments on fn call!\n", -1);
     }
-    return exprIndex;
-}
-
-
-
-static u32 equality(Parser& parser)
-{
-    u32 exprIndex = comparison(parser);
-
-    while(match(parser, TokenType::BANG_EQUAL, TokenType::EQUAL_EQUAL))
-    {
-        u32 prevIndex = previousIndex(parser);
-        u32 rightIndex = comparison(parser);
-
-        Expr expr{
-            .tokenOperIndex = prevIndex,
-            .leftExprIndex = exprIndex,
-            .rightExprIndex = rightIndex,
-            .exprType = ExprType_Binary
-        };
+    consume(parser, TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
 
-        exprIndex = addExpr(parser.mem, expr);
-    }
-    return exprIndex;
+    Expr expr {
+        .tokenOperIndex = previousIndex(parser),
+        .callee = callee,
+        .argsStart = (u32)parser.mem.callArgs.size(),
+        .exprType = ExprType::ExprType_CallFn,
+        .argCount = (u16)args
+    };
+    parser.mem.callArgs.insert(parser.mem.callArgs.end(), parser.argStack.begin() + argsBase, parser.argStack.end());
+    parser.argStack.resize(argsBase);
+    return addExpr(parser.mem, expr);
 }
 
-static u32 logicalAnd(Parser& parser)
+static u32 finishAssignment(Parser& parser, u32 targetIndex, u32 equalTokenIndex)
 {
-    u32 exprIndex = equality(parser);
-    while(match(parser, TokenType::AND))
+    const Expr& target = parser.mem.expressions[targetIndex];
+    if(target.exprType != ExprType_Variable)
     {
-        u32 prevIndex = previousIndex(parser);
-        u32 rightIndex = equality(parser);
-
-        Expr expr{
-            .tokenOperIndex = prevIndex,
-            .leftExprIndex = exprIndex,
-            .rightExprIndex = rightIndex,
-            .exprType = ExprType_Logical
-        };
-
-        exprIndex = addExpr(parser.mem, expr);
-
+        LOG_ERROR("Invalid target assignment!");
+        parseError(parser, tokens_get(parser.mem.tokens, equalTokenIndex), "Invalid target assignment!\n", -30);
     }
+    // The assignment is named by the target token, the target node is dropped.
+    u32 nameTokenIndex = target.tokenOperIndex;
 
-    return exprIndex;
+    // Right associative, a = b = c assigns c to b first.
+    u32 exprRight = parsePrecedence(parser, Precedence_Assignment);
+    Expr newExpr{
+        .tokenOperIndex = nameTokenIndex,
+        .rightExprIndex = exprRight,
+        .exprType = ExprType_Assign
+    };
+    return addExpr(parser.mem, newExpr);
 }
 
-static u32 logicalOr(Parser& parser)
+// Prefix operators bind tighter than any binary operator but looser than calls.
+static u32 prefix(Parser& parser)
 {
-    u32 exprIndex = logicalAnd(parser);
-    while(match(parser, TokenType::OR))
+    TokenType type = peekType(parser);
+    if(type == TokenType::BANG || type == TokenType::MINUS)
     {
+        advance(parser);
         u32 prevIndex = previousIndex(parser);
-        u32 rightIndex = equality(parser);
+        u32 rightIndex = parsePrecedence(parser, Precedence_Unary);
 
         Expr expr{
             .tokenOperIndex = prevIndex,
-            .leftExprIndex = exprIndex,
             .rightExprIndex = rightIndex,
-            .exprType = ExprType_Logical
+            .exprType = ExprType_Unary
         };
-
-        exprIndex = addExpr(parser.mem, expr);
-
+        return addExpr(parser.mem, expr);
     }
-
-    return exprIndex;
+    return primary(parser);
 }
 
-static u32 assignment(Parser& parser)
+// Parses operators binding at least as tight as precedence. Binary operators
+// are left associative, their right side starts one level higher.
+static u32 parsePrecedence(Parser& parser, Precedence precedence)
 {
-    u32 exprIndex = logicalOr(parser);
-
-    while(match(parser, TokenType::EQUAL))
+    u32 exprIndex = prefix(parser);
+    for(;;)
     {
-        u32 prevIndex = previousIndex(parser);
-        u32 exprRight = assignment(parser);
-
-        const Expr& right = parser.mem.expressions[exprRight];
-        const Expr& expr = parser.mem.expressions[exprIndex];
-        if(expr.exprType == ExprType_Variable)
+        const InfixRule& rule = infixRules.rules[(u32)peekType(parser)];
+        if(rule.precedence == Precedence_None || rule.precedence < precedence)
         {
-            const Token& token = parser.mem.tokens[right.tokenOperIndex];
-            const std::string& name = parser.mem.strings[expr.exprValue.stringIndex];
-            Expr newExpr{
-                .exprValue = expr.exprValue,
-                //.tokenOperIndex = right.tokenOperIndex,
-                .tokenOperIndex = prevIndex,
-                //.tokenOperIndex = expr.exprValue.stringIndex,
-                .rightExprIndex = exprRight,
-                .exprType = ExprType_Assign
-            };
-            return addExpr(parser.mem, newExpr);
+            break;
+        }
+        advance(parser);
+        u32 operIndex = previousIndex(parser);
+        switch(rule.exprType)
+        {
+            case ExprType_CallFn:
+                exprIndex = finishCall(parser, exprIndex);
+                break;
+            case ExprType_Assign:
+                exprIndex = finishAssignment(parser, exprIndex, operIndex);
+                break;
+            default:
+            {
+                u32 rightIndex = parsePrecedence(parser, (Precedence)(rule.precedence + 1));
+                Expr expr{
+                    .tokenOperIndex = operIndex,
+                    .leftExprIndex = exprIndex,
+                    .rightExprIndex = rightIndex,
+                    .exprType = rule.exprType
+                };
+                exprIndex = addExpr(parser.mem, expr);
+                break;
+            }
         }
-        reportError(parser.mem, parser.mem.tokens[prevIndex], "Invalid target assignment!\n");
-
-        LOG_ERROR("Invalid target assignment!");
-        DEBUG_BREAK_MACRO(-30);
     }
     return exprIndex;
 }
 
-
-
 static u32 expression(Parser& parser)
 {
-    u32 exprIndex = assignment(parser);
-
-    return exprIndex;
+    return parsePrecedence(parser, Precedence_Assignment);
 }
 
 
@@ -450,8 +458,7 @@ static u32 declaration(Parser& parser)
         consume(parser, TokenType::IDENTIFIER, "Expected variable name!");
         if(!match(parser, TokenType::EQUAL))
         {
-            reportError(parser.mem, peek(parser), "variable not set!");
-            DEBUG_BREAK_MACRO(10);
+            parseError(parser, peek(parser), "variable not set!", 10);
         }
         u32 exprIndex = expression(parser);
         consume(parser, TokenType::SEMICOLON, "Expect ';' after variable declaration!");
@@ -474,7 +481,7 @@ static u32 declaration(Parser& parser)
         {
             elseStatementIndex = declaration(parser);
         }
-        addStatement(parser.mem, Statement{
+        return addStatement(parser.mem, Statement{
             .expressionIndex = exprIndex,
             .ifStatementIndex = statementIndex,
             .elseStatementIndex = elseStatementIndex,
@@ -506,7 +513,6 @@ static u32 declaration(Parser& parser)
     }
     else if(match(parser, TokenType::RETURN))
     {
-        const Token& keyword = previous(parser);
         u32 exprIndex = ~0u;
         if(!check(parser, TokenType::SEMICOLON))
         {
@@ -521,42 +527,50 @@ static u32 declaration(Parser& parser)
     }
     else if(match(parser, TokenType::FUNC))
     {
-        const Token& name = consume(parser, TokenType::IDENTIFIER, "Expect function name");
+        consume(parser, TokenType::IDENTIFIER, "Expect function name");
+        u32 nameTokenIndex = previousIndex(parser);
         consume(parser, TokenType::LEFT_PAREN, "Expect '(' after function name");
+        // Parameters come before the body, nested functions cannot interleave them.
         Statement stmnt{
+            .tokenNameIndex = nameTokenIndex,
+            .paramsStart = (u32)parser.mem.paramNames.size(),
             .type = StatementType_CallFn
         };
-        u32 args = 0;
         if (!check(parser, TokenType::RIGHT_PAREN))
         {
             do
             {
-                if (args >= 4)
-                {
-                    reportError(parser.mem, peek(parser), "Function can only have 4 parameters!");
-                    DEBUG_BREAK_MACRO(10);
-                }
                 consume(parser, TokenType::IDENTIFIER, "Expected parameter name.");
-                stmnt.paramsNameIndices[args] = previousIndex(parser);
-                args++;
+                parser.mem.paramNames.push_back(previousIndex(parser));
             } while (match(parser, TokenType::COMMA));
         }
-        stmnt.paramsNameIndicesCount = args;
+        stmnt.paramsCount = parser.mem.paramNames.size() - stmnt.paramsStart;
+        if (stmnt.paramsCount > MaxCallArgs)
+        {
+            parseError(parser, peek(parser), "Too many function parameters!", 10);
+        }
         consume(parser, TokenType::RIGHT_PAREN, "Expected ')' after parameters");
         consume(parser, TokenType::LEFT_BRACE, "Expected '{' before function body.");
+        stmnt.bodyStart = previousIndex(parser);
 
-        i32 blockIndex = block(parser, parser.mem.currentBlockIndex);
-        Block& b = parser.mem.blocks[blockIndex];
-        for(u32 i = 0; i < args; ++i)
+        // Parameters and the function name get their slots in the resolver.
+        if(parser.lazyBodies)
         {
-            const Token& t = parser.mem.tokens[stmnt.paramsNameIndices[i]];
-            std::string& str = parser.mem.strings[t.value.stringIndex];
-            b.variables.insert({str, ExprValue{}});
+            bool declaresFn = skipBody(parser);
+            stmnt.blockIndex = -1;
+            stmnt.bodyEnd = previousIndex(parser);
+            u32 fnIndex = addStatement(parser.mem, stmnt);
+            if(declaresFn)
+            {
+                parser.nestedFnBodies.push_back(fnIndex);
+            }
+        }
+        else
+        {
+            stmnt.blockIndex = block(parser, parser.mem.currentBlockIndex);
+            stmnt.bodyEnd = previousIndex(parser);
+            addStatement(parser.mem, stmnt);
         }
-        stmnt.blockIndex = blockIndex;
-        u32 fnIndex = addStatement(parser.mem, stmnt);
-        Block& b0 = parser.mem.blocks[0];
-        b0.variables.insert({getConstString(parser.mem, name), ExprValue{.stringIndex = fnIndex }});
         return ~0;
     }
     else if(match(parser, TokenType::LEFT_BRACE))
@@ -580,15 +594,37 @@ static u32 declaration(Parser& parser)
 }
 
 
+// Pre-parse of a function body, only braces are matched. Stops after the
+// closing '}' and returns whether the body declares functions.
+static bool skipBody(Parser& parser)
+{
+    u32 depth = 1;
+    bool declaresFn = false;
+    while(depth > 0 && !isAtEnd(parser))
+    {
+        TokenType type = peekType(parser);
+        depth += type == TokenType::LEFT_BRACE ? 1 : 0;
+        depth -= type == TokenType::RIGHT_BRACE ? 1 : 0;
+        declaresFn |= type == TokenType::FUNC;
+        advance(parser);
+    }
+    if(depth > 0)
+    {
+        parseError(parser, peek(parser), "Expected '}' after function body!", -1);
+    }
+    return declaresFn;
+}
+
 static i32 block(Parser& parser, i32 parentBlockIndex)
 {
     i32 blockIndex = parser.mem.blocks.size();
     parser.mem.blocks.emplace_back(Block{.parentBlockIndex = parentBlockIndex });
     //parser.mem.currentBlockIndex = blockIndex;
-    Block& block = parser.mem.blocks[blockIndex];
     while(!check(parser, TokenType::RIGHT_BRACE) && !isAtEnd(parser))
     {
-        block.statementIndices.push_back(declaration(parser));
+        // Nested blocks grow mem.blocks, so no reference is held across declaration().
+        u32 statementIndex = declaration(parser);
+        parser.mem.blocks[blockIndex].statementIndices.push_back(statementIndex);
     }
     consume(parser, TokenType::RIGHT_BRACE, "Expected '}' after block!");
     //parser.mem.currentBlockIndex = parentBlockIndex;
@@ -607,38 +643,72 @@ bool printAst(const MyMemory& mem, const Expr& expr, std::string& printStr)
         }
         case ExprType_Binary:
         {
-            const std::string& lexMe = getTokenValueAsString(mem, mem.tokens[expr.tokenOperIndex]);
+            const std::string lexMe(getTokenLexeme(mem, expr.tokenOperIndex));
             if(!parenthesize(mem, lexMe, expr.leftExprIndex, expr.rightExprIndex, printStr))
             {
                 return false;
             }
         }
         break;
-        case ExprType_Grouping:
+        case ExprType_Literal:
         {
-            if(!parenthesize(mem, "group", expr.rightExprIndex, printStr))
+            const ExprValue& value = mem.literals[expr.literalIndex];
+            switch (value.literalType)
+            {
+            case LiteralType_None: printf("Literaltype none!\n"); break;
+            case LiteralType_Null: printStr.append("nil"); break;
+            case LiteralType_I64: printStr.append(std::to_string(value.value)); break;
+            case LiteralType_Double: printStr.append(std::to_string(value.doubleValue)); break;
+            case LiteralType_String: printStr.append(mem.strings[value.stringIndex]); break;
+            case LiteralType_Boolean: printStr.append(value.value != 0 ? "true" : "false"); break;
+            case LiteralType_Identifier: printStr.append(getSymbolName(mem, value.symbolIndex)); break;
+            case LiteralType_Function: printStr.append("<fn>"); break;
+            }
+        }
+        break;
+        case ExprType_Unary:
+        {
+            const std::string lexMe(getTokenLexeme(mem, expr.tokenOperIndex));
+            if (!parenthesize(mem, lexMe, expr.rightExprIndex, printStr))
             {
                 return false;
             }
         }
         break;
-        case ExprType_Literal:
+        case ExprType_Variable:
         {
-            switch (expr.exprValue.literalType)
+            printStr.append(getTokenLexeme(mem, expr.tokenOperIndex));
+        }
+        break;
+        case ExprType_Assign:
+        {
+            std::string name = "= " + std::string(getTokenLexeme(mem, expr.tokenOperIndex));
+            if(!parenthesize(mem, name, expr.rightExprIndex, printStr))
             {
-            case LiteralType_None: printf("Literaltype none!\n"); break;
-            case LiteralType_Null: printStr.append("nil"); break;
-            case LiteralType_I64: printStr.append(std::to_string(expr.exprValue.value)); break;
-            case LiteralType_Double: printStr.append(std::to_string(expr.exprValue.doubleValue)); break;
-            case LiteralType_String: printStr.append(mem.strings[expr.exprValue.stringIndex]); break;
-            case LiteralType_Boolean: printStr.append("boolean"); break;
+                return false;
             }
         }
         break;
-        case ExprType_Unary:
+        case ExprType_Logical:
         {
-            const std::string& lexMe = getTokenValueAsString(mem, mem.tokens[expr.tokenOperIndex]);
-            if (!parenthesize(mem, lexMe, expr.rightExprIndex, printStr))
+            const std::string lexMe(getTokenLexeme(mem, expr.tokenOperIndex));
+            if(!parenthesize(mem, lexMe, expr.leftExprIndex, expr.rightExprIndex, printStr))
+            {
+                return false;
+            }
+        }
+        break;
+        case ExprType_CallFn:
+        {
+            printStr.append("(call ");
+            bool result = printAst(mem, mem.expressions[expr.callee], printStr);
+            for(u32 i = 0; i < expr.argCount; ++i)
+            {
+                printStr.append(" ");
+                result &= printAst(mem, mem.expressions[mem.callArgs[expr.argsStart + i]], printStr);
+            }
+            printStr.append(")");
+            if(!result)
             {
                 return false;
             }
@@ -649,32 +719,117 @@ bool printAst(const MyMemory& mem, const Expr& expr, std::string& printStr)
     return true;
 }
 
+static void printStatement(const MyMemory& mem, u32 statementIndex, u32 depth);
+
+static void printStatements(const MyMemory& mem, const std::vector<u32>& statementIndices, u32 depth)
+{
+    for(u32 index : statementIndices)
+    {
+        // Function declarations live in mem.functions and leave ~0 in the block.
+        if(index < mem.statements.size())
+        {
+            printStatement(mem, index, depth);
+        }
+    }
+}
+
+static void printLine(const MyMemory& mem, u32 depth, const std::string& name, u32 exprIndex)
+{
+    std::string s(depth * 4, ' ');
+    s.append("(");
+    s.append(name);
+    if(exprIndex != ~0u)
+    {
+        s.append(" ");
+        printAst(mem, mem.expressions[exprIndex], s);
+    }
+    s.append(")");
+    printf("%s\n", s.c_str());
+}
+
+static void printStatement(const MyMemory& mem, u32 statementIndex, u32 depth)
+{
+    const Statement& statement = mem.statements[statementIndex];
+    switch(statement.type)
+    {
+        case StatementType_Expression:
+            printLine(mem, depth, "expr", statement.expressionIndex);
+            break;
+        case StatementType_Print:
+            printLine(mem, depth, "print", statement.expressionIndex);
+            break;
+        case StatementType_VarDeclare:
+            printLine(mem, depth, "var " + std::string(getTokenLexeme(mem, statement.tokenIndex)), statement.expressionIndex);
+            break;
+        case StatementType_Block:
+            printLine(mem, depth, "block", ~0u);
+            printStatements(mem, mem.blocks[statement.blockIndex].statementIndices, depth + 1);
+            break;
+        case StatementType_If:
+            printLine(mem, depth, "if", statement.expressionIndex);
+            printStatement(mem, statement.ifStatementIndex, depth + 1);
+            if(statement.elseStatementIndex < mem.statements.size())
+            {
+                printLine(mem, depth, "else", ~0u);
+                printStatement(mem, statement.elseStatementIndex, depth + 1);
+            }
+            break;
+        case StatementType_While:
+            printLine(mem, depth, "while", statement.expressionIndex);
+            printStatement(mem, statement.whileStatementIndex, depth + 1);
+            break;
+        case StatementType_Return:
+            printLine(mem, depth, "return", statement.expressionIndex);
+            break;
+        case StatementType_CallFn:
+        case StatementType_Count:
+            break;
+    }
+}
+
+void ast_print(const MyMemory& mem)
+{
+    printStatements(mem, mem.blocks[0].statementIndices, 0);
+    for(const Statement& function : mem.functions)
+    {
+        std::string name = "fn " + std::string(getTokenLexeme(mem, function.tokenNameIndex));
+        for(u32 i = 0; i < function.paramsCount; ++i)
+        {
+            name += " " + std::string(getTokenLexeme(mem, mem.paramNames[function.paramsStart + i]));
+        }
+        if(function.blockIndex < 0)
+        {
+            printLine(mem, 0, name + " <lazy>", ~0u);
+            continue;
+        }
+        printLine(mem, 0, name, ~0u);
+        printStatements(mem, mem.blocks[function.blockIndex].statementIndices, 1);
+    }
+}
+
 
 
 
 static bool ast_test(MyMemory& mem)
 {
-    u32 minusStr = addString(mem, "-");
-    u32 starStr = addString(mem, "*");
-    u32 minusTokenIndex = addToken(mem, Token{ .value{.stringIndex = minusStr, .literalType = LiteralType_String }, .line = 1, .type = TokenType::MINUS });
-    u32 starTokenIndex = addToken(mem, Token{ .value{.stringIndex = starStr, .literalType = LiteralType_String }, .line = 1, .type = TokenType::STAR });
+    mem.source.data = (const u8*)"-*";
+    mem.source.size = 2;
+    u32 minusTokenIndex = addToken(mem, Token{ .value{.literalType = LiteralType_None }, .lexemeOffset = 0, .lexemeLength = 1, .line = 1, .type = TokenType::MINUS });
+    u32 starTokenIndex = addToken(mem, Token{ .value{.literalType = LiteralType_None }, .lexemeOffset = 1, .lexemeLength = 1, .line = 1, .type = TokenType::STAR });
 
-    Expr u64Lit{ .exprValue = { .value = 123, .literalType = LiteralType_I64 }, .exprType = ExprType_Literal,  };
+    Expr u64Lit{ .literalIndex = addLiteral(mem, { .value = 123, .literalType = LiteralType_I64 }), .exprType = ExprType_Literal,  };
     u32 u64ExpressionIndex = addExpr(mem, u64Lit);
 
-    Expr doubleLit{ .exprValue = { .doubleValue = 45.67, .literalType = LiteralType_Double }, .exprType = ExprType_Literal,  };
+    Expr doubleLit{ .literalIndex = addLiteral(mem, { .doubleValue = 45.67, .literalType = LiteralType_Double }), .exprType = ExprType_Literal,  };
     u32 doubleExpressionIndex= addExpr(mem, doubleLit);
 
     Expr unaryExpr{ .tokenOperIndex = minusTokenIndex, .rightExprIndex = u64ExpressionIndex, .exprType = ExprType_Unary };
     u32 unaryExpressionIndex = addExpr(mem, unaryExpr);
 
-    Expr grouping{ .rightExprIndex = doubleExpressionIndex, .exprType = ExprType_Grouping };
-    u32 groupingExpressionIndex = addExpr(mem, grouping);
-
     Expr expr{
         .tokenOperIndex = starTokenIndex,
         .leftExprIndex = unaryExpressionIndex,
-        .rightExprIndex = groupingExpressionIndex,
+        .rightExprIndex = doubleExpressionIndex,
         .exprType = ExprType_Binary
     };
     std::string s;
@@ -688,18 +843,77 @@ static bool ast_test(MyMemory& mem)
     printAst(mem, unaryExpr, s);
     printf("%s\n", s.data());
     s.clear();
-    printAst(mem, grouping, s);
-    printf("%s\n", s.data());
-    s.clear();
     printAst(mem, expr, s);
     printf("%s\n", s.data());
 
     return true;
 }
 
-bool ast_generate(MyMemory& mem)
+static bool parseBody(MyMemory& mem, u32 fnIndex, bool lazyBodies);
+
+// Parses the bodies the parser skipped over but which declare functions.
+static bool parseNestedFnBodies(MyMemory& mem, const std::vector<u32>& fnIndices, bool lazyBodies)
+{
+    bool result = true;
+    for(u32 fnIndex : fnIndices)
+    {
+        result &= parseBody(mem, fnIndex, lazyBodies);
+    }
+    return result;
+}
+
+// Rescans the body from the source, its tokens are appended to mem.tokens again
+// because skipped tokens carry no values.
+static bool parseBody(MyMemory& mem, u32 fnIndex, bool lazyBodies)
 {
-    Parser parser {.mem = mem, .currentPos = 0 };
+    u32 braceToken = mem.functions[fnIndex].bodyStart;
+    u32 bodyOffset = mem.tokens.lexemes[braceToken].offset + 1;
+    Scanner scanner = scanner_beginAt(mem, bodyOffset, tokens_line(mem.tokens, braceToken));
+    u32 firstToken = tokens_count(mem.tokens);
+    Parser parser {.mem = mem, .scanner = scanner, .currentPos = (i32)firstToken, .scannedCount = firstToken,
+        .lazyBodies = lazyBodies };
+
+    i32 blockIndex = block(parser, mem.currentBlockIndex);
+    mem.functions[fnIndex].blockIndex = blockIndex;
+    return !scanner.hasErrors && parseNestedFnBodies(mem, parser.nestedFnBodies, lazyBodies);
+}
+
+bool ast_parseFunction(MyMemory& mem, u32 fnIndex)
+{
+    assert(mem.functions[fnIndex].blockIndex < 0);
+    u32 firstExpr = mem.expressions.size();
+    if(!parseBody(mem, fnIndex, true))
+    {
+        return false;
+    }
+    if(mem.optLevel > 0)
+    {
+        optimizer_run(mem, firstExpr);
+    }
+    return resolver_resolveFunction(mem, fnIndex);
+}
+
+void ast_reserveLazyBodies(MyMemory& mem)
+{
+    // Every statement, expression and block takes at least one token.
+    u32 tokenCount = 0;
+    for(const Statement& function : mem.functions)
+    {
+        tokenCount += function.blockIndex < 0 ? function.bodyEnd - function.bodyStart : 0;
+    }
+    mem.expressions.reserve(mem.expressions.size() + tokenCount);
+    mem.statements.reserve(mem.statements.size() + tokenCount);
+    mem.blocks.reserve(mem.blocks.size() + tokenCount);
+}
+
+bool ast_generate(MyMemory& mem, u32 scanThreads, bool lazyBodies)
+{
+    Scanner scanner = scanner_begin(mem);
+    if(scanThreads > 1)
+    {
+        scanner_prescan(scanner, scanThreads);
+    }
+    Parser parser {.mem = mem, .scanner = scanner, .currentPos = 0, .scannedCount = 0, .lazyBodies = lazyBodies };
 
     mem.blocks.emplace_back(Block{.parentBlockIndex = -1});
     while(!isAtEnd(parser))
@@ -708,6 +922,50 @@ bool ast_generate(MyMemory& mem)
         if(statementIndex != ~0u)
             mem.blocks[0].statementIndices.push_back(statementIndex);
     }
-    return true;
+    return !scanner.hasErrors && parseNestedFnBodies(mem, parser.nestedFnBodies, lazyBodies);
     //return ast_test(mem);
-}
\ No newline at end of file
+}
+
+bool ast_generateMore(MyMemory& mem, u32 sourceOffset, i32 line)
+{
+    if(mem.blocks.empty())
+    {
+        mem.blocks.emplace_back(Block{.parentBlockIndex = -1});
+    }
+    // Everything the input adds is dropped again on an error. Tokens and
+    // interned names stay, nothing refers to them.
+    u32 topLevelCount = mem.blocks[0].statementIndices.size();
+    u32 stringCount = mem.strings.size();
+    u32 literalCount = mem.literals.size();
+    u32 exprCount = mem.expressions.size();
+    u32 callArgCount = mem.callArgs.size();
+    u32 paramNameCount = mem.paramNames.size();
+    u32 statementCount = mem.statements.size();
+    u32 functionCount = mem.functions.size();
+    u32 blockCount = mem.blocks.size();
+
+    Scanner scanner = scanner_beginAt(mem, sourceOffset, line);
+    u32 firstToken = tokens_count(mem.tokens);
+    Parser parser {.mem = mem, .scanner = scanner, .currentPos = (i32)firstToken, .scannedCount = firstToken,
+        .lazyBodies = false, .recoverErrors = true };
+    while(!isAtEnd(parser))
+    {
+        u32 statementIndex = declaration(parser);
+        if(statementIndex != ~0u)
+            mem.blocks[0].statementIndices.push_back(statementIndex);
+    }
+    if(!parser.hasErrors && !scanner.hasErrors)
+    {
+        return true;
+    }
+    mem.blocks[0].statementIndices.resize(topLevelCount);
+    stringHeap_truncate(mem, stringCount);
+    mem.literals.resize(literalCount);
+    mem.expressions.resize(exprCount);
+    mem.callArgs.resize(callArgCount);
+    mem.paramNames.resize(paramNameCount);
+    mem.statements.resize(statementCount);
+    mem.functions.resize(functionCount);
+    mem.blocks.resize(blockCount);
+    return false;
+}
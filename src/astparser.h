@@ -2,10 +2,26 @@
 
 #include <string>
 
+#include "mytypes.h"
+
 struct Expr;
 struct MyMemory;
 
 bool printAst(const MyMemory& mem, const Expr& expr, std::string& printStr);
+// Dumps every statement with its expression tree, functions last.
+void ast_print(const MyMemory& mem);
 
-bool ast_generate(MyMemory& mem);
+// scanThreads > 1 scans the whole source up front in parallel, see scanner_prescan().
+// lazyBodies only matches the braces of function bodies, leaving blockIndex -1.
+// Bodies which declare functions themselves are always parsed.
+bool ast_generate(MyMemory& mem, u32 scanThreads, bool lazyBodies);
+// Parses source appended at sourceOffset, for the prompt. New top-level statements
+// go to the end of blocks[0], functions to mem.functions. A parse error is
+// reported and the input dropped, the program parsed so far is left as it was.
+bool ast_generateMore(MyMemory& mem, u32 sourceOffset, i32 line);
+// Parses, optimizes and resolves a skipped function body, on its first call.
+bool ast_parseFunction(MyMemory& mem, u32 fnIndex);
+// Reserves room for every skipped body in the node pools, so a body parsed
+// while the interpreter holds references into them never moves them.
+void ast_reserveLazyBodies(MyMemory& mem);
 
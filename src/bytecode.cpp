@@ -0,0 +1,63 @@
+#include "bytecode.h"
+
+#include "helpers.h"
+#include "mymemory.h"
+
+#include <stdio.h>
+
+u32 getInstructionSize(OpCode op)
+{
+    switch(op)
+    {
+        case OpCode_Constant:
+        case OpCode_GetGlobal:
+        case OpCode_SetGlobal:
+        case OpCode_DefineGlobal:
+        case OpCode_GetLocal:
+        case OpCode_SetLocal:
+        case OpCode_DefineLocal:
+        case OpCode_Jump:
+        case OpCode_JumpIfFalse:
+        case OpCode_JumpIfTrue:
+        case OpCode_Call:
+            return 1 + sizeof(u32);
+        default:
+            return 1;
+    }
+}
+
+void printBytecode(const MyMemory& mem)
+{
+    u32 nextFunction = 0;
+    for(u32 offset = 0; offset < mem.code.size();)
+    {
+        while(nextFunction < mem.functionEntries.size() && mem.functionEntries[nextFunction] == offset)
+        {
+            printf("-- fn %u --\n", nextFunction);
+            nextFunction++;
+        }
+        OpCode op = (OpCode)mem.code[offset];
+        u32 size = getInstructionSize(op);
+        printf("%06u [line %4i] %-14s", offset, mem.codeLines[offset], OPCODE_NAMES[op]);
+        if(size > 1)
+        {
+            u32 operand = readOperand(&mem.code[offset + 1]);
+            switch(op)
+            {
+                case OpCode_Constant:
+                    printf(" %u '%s'", operand, stringify(mem, mem.constants[operand]).data());
+                    break;
+                case OpCode_GetGlobal:
+                case OpCode_SetGlobal:
+                case OpCode_DefineGlobal:
+                    printf(" %u '%s'", operand, getSymbolName(mem, mem.globalNames[operand]).data());
+                    break;
+                default:
+                    printf(" %u", operand);
+                    break;
+            }
+        }
+        printf("\n");
+        offset += size;
+    }
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <string.h>
+
+#include "mytypes.h"
+
+struct MyMemory;
+
+enum OpCode : u8
+{
+    OpCode_Constant,    // u32 constant index
+    OpCode_Nil,
+    OpCode_True,
+    OpCode_False,
+    OpCode_Pop,
+
+    OpCode_GetGlobal,   // u32 global slot
+    OpCode_SetGlobal,   // u32 global slot
+    OpCode_DefineGlobal,// u32 global slot
+    OpCode_GetLocal,    // u32 frame slot
+    OpCode_SetLocal,    // u32 frame slot
+    OpCode_DefineLocal, // u32 frame slot
+
+    OpCode_Add,
+    OpCode_Subtract,
+    OpCode_Multiply,
+    OpCode_Divide,
+    OpCode_Greater,
+    OpCode_GreaterEqual,
+    OpCode_Lesser,
+    OpCode_LesserEqual,
+    OpCode_Equal,
+    OpCode_NotEqual,
+
+    // Quickened forms of the binary ops, the vm rewrites them in place.
+    OpCode_AddInt,
+    OpCode_SubtractInt,
+    OpCode_MultiplyInt,
+    OpCode_DivideInt,
+    OpCode_GreaterInt,
+    OpCode_GreaterEqualInt,
+    OpCode_LesserInt,
+    OpCode_LesserEqualInt,
+    OpCode_EqualInt,
+    OpCode_NotEqualInt,
+    OpCode_AddDouble,
+    OpCode_SubtractDouble,
+    OpCode_MultiplyDouble,
+    OpCode_DivideDouble,
+    OpCode_GreaterDouble,
+    OpCode_GreaterEqualDouble,
+    OpCode_LesserDouble,
+    OpCode_LesserEqualDouble,
+    OpCode_EqualDouble,
+    OpCode_NotEqualDouble,
+
+    OpCode_Negate,
+    OpCode_Not,
+
+    OpCode_Print,
+    OpCode_Echo,        // prompt results, functions without a return value print nothing
+
+    OpCode_Jump,        // u32 absolute target
+    OpCode_JumpIfFalse, // u32 absolute target, keeps condition on stack
+    OpCode_JumpIfTrue,  // u32 absolute target, keeps condition on stack
+
+    OpCode_Call,        // u32 argument count
+    OpCode_Return,
+
+    OpCode_Halt,
+
+    OpCode_Count,
+};
+
+static const char* OPCODE_NAMES[] = {
+    "CONSTANT",
+    "NIL",
+    "TRUE",
+    "FALSE",
+    "POP",
+
+    "GET_GLOBAL",
+    "SET_GLOBAL",
+    "DEFINE_GLOBAL",
+    "GET_LOCAL",
+    "SET_LOCAL",
+    "DEFINE_LOCAL",
+
+    "ADD",
+    "SUBTRACT",
+    "MULTIPLY",
+    "DIVIDE",
+    "GREATER",
+    "GREATER_EQUAL",
+    "LESSER",
+    "LESSER_EQUAL",
+    "EQUAL",
+    "NOT_EQUAL",
+
+    "ADD_INT",
+    "SUBTRACT_INT",
+    "MULTIPLY_INT",
+    "DIVIDE_INT",
+    "GREATER_INT",
+    "GREATER_EQUAL_INT",
+    "LESSER_INT",
+    "LESSER_EQUAL_INT",
+    "EQUAL_INT",
+    "NOT_EQUAL_INT",
+    "ADD_DOUBLE",
+    "SUBTRACT_DOUBLE",
+    "MULTIPLY_DOUBLE",
+    "DIVIDE_DOUBLE",
+    "GREATER_DOUBLE",
+    "GREATER_EQUAL_DOUBLE",
+    "LESSER_DOUBLE",
+    "LESSER_EQUAL_DOUBLE",
+    "EQUAL_DOUBLE",
+    "NOT_EQUAL_DOUBLE",
+
+    "NEGATE",
+    "NOT",
+
+    "PRINT",
+    "ECHO",
+
+    "JUMP",
+    "JUMP_IF_FALSE",
+    "JUMP_IF_TRUE",
+
+    "CALL",
+    "RETURN",
+
+    "HALT",
+};
+static_assert(sizeof(OPCODE_NAMES) / sizeof(const char*) == OpCode_Count);
+
+// The quickened forms follow the generic binary ops in the same order.
+static_assert(OpCode_NotEqual - OpCode_Add == OpCode_NotEqualInt - OpCode_AddInt);
+static_assert(OpCode_NotEqual - OpCode_Add == OpCode_NotEqualDouble - OpCode_AddDouble);
+
+static OpCode getIntOpCode(OpCode binaryOp)
+{
+    return (OpCode)(binaryOp - OpCode_Add + OpCode_AddInt);
+}
+
+static OpCode getDoubleOpCode(OpCode binaryOp)
+{
+    return (OpCode)(binaryOp - OpCode_Add + OpCode_AddDouble);
+}
+
+static u32 readOperand(const u8* code)
+{
+    u32 value;
+    memcpy(&value, code, sizeof(u32));
+    return value;
+}
+
+static void writeOperand(u8* code, u32 value)
+{
+    memcpy(code, &value, sizeof(u32));
+}
+
+// Size of the instruction including the opcode byte.
+u32 getInstructionSize(OpCode op);
+
+void printBytecode(const MyMemory& mem);
@@ -0,0 +1,39 @@
+#include "callstack.h"
+
+#include <assert.h>
+
+void callStack_init(CallStack& callStack, u32 scriptSlotCount)
+{
+    callStack.frames.resize(CallStack_MaxFrames);
+    callStack.slots.resize(scriptSlotCount > CallStack_MaxSlots ? scriptSlotCount : CallStack_MaxSlots);
+    callStack.frameCount = 0;
+    callStack.slotTop = 0;
+    callStack.frameBase = 0;
+    callStack_push(callStack, ~0u, ~0u, scriptSlotCount);
+}
+
+CallFrame* callStack_push(CallStack& callStack, u32 callExprIndex, u32 fnIndex, u32 slotCount)
+{
+    if(callStack.frameCount >= callStack.frames.size() || callStack.slotTop + slotCount > callStack.slots.size())
+    {
+        return nullptr;
+    }
+    CallFrame& frame = callStack.frames[callStack.frameCount++];
+    frame = CallFrame{
+        .callExprIndex = callExprIndex,
+        .fnIndex = fnIndex,
+        .slotBase = callStack.slotTop,
+        .slotCount = slotCount
+    };
+    callStack.slotTop += slotCount;
+    callStack.frameBase = frame.slotBase;
+    return &frame;
+}
+
+void callStack_pop(CallStack& callStack)
+{
+    assert(callStack.frameCount > 1);
+    callStack.frameCount--;
+    callStack.slotTop = callStack.frames[callStack.frameCount].slotBase;
+    callStack.frameBase = callStack.frames[callStack.frameCount - 1].slotBase;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "expr.h"
+#include "mytypes.h"
+
+static constexpr u32 CallStack_MaxFrames = 1024;
+static constexpr u32 CallStack_MaxSlots = 64 * 1024;
+
+// Frame of the tree-walking interpreter. Frame 0 is the top-level script.
+struct CallFrame
+{
+    // Return address, the ExprType_CallFn expression that pushed the frame.
+    u32 callExprIndex;
+    u32 fnIndex;
+    // Parameters first, then the locals given by the resolver.
+    u32 slotBase;
+    u32 slotCount;
+};
+
+// Both arrays are allocated once in callStack_init(), a call never allocates.
+struct CallStack
+{
+    std::vector<CallFrame> frames;
+    std::vector<ExprValue> slots;
+    u32 frameCount;
+    u32 slotTop;
+    // slotBase of the top frame, cached for local access.
+    u32 frameBase;
+};
+
+void callStack_init(CallStack& callStack, u32 scriptSlotCount);
+// Returns nullptr on stack overflow.
+CallFrame* callStack_push(CallStack& callStack, u32 callExprIndex, u32 fnIndex, u32 slotCount);
+void callStack_pop(CallStack& callStack);
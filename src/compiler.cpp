@@ -0,0 +1,383 @@
+#include "compiler.h"
+
+#include "bytecode.h"
+#include "errors.h"
+#include "expr.h"
+#include "helpers.h"
+#include "mymemory.h"
+#include "token.h"
+#include "typeinfer.h"
+
+#include <assert.h>
+
+struct Compiler
+{
+    MyMemory& mem;
+    i32 line;
+    bool inFunction;
+    bool hasErrors;
+};
+
+static void compileStatement(Compiler& compiler, u32 statementIndex);
+static void compileExpression(Compiler& compiler, u32 exprIndex);
+
+static void compileError(Compiler& compiler, const std::string& message)
+{
+    compiler.hasErrors = true;
+    reportError(compiler.line, message, "in compiler");
+}
+
+static void emitByte(Compiler& compiler, u8 byte)
+{
+    compiler.mem.code.push_back(byte);
+    compiler.mem.codeLines.push_back(compiler.line);
+}
+
+static void emitOp(Compiler& compiler, OpCode op)
+{
+    emitByte(compiler, op);
+}
+
+static void emitOp(Compiler& compiler, OpCode op, u32 operand)
+{
+    emitByte(compiler, op);
+    u8 bytes[sizeof(u32)];
+    writeOperand(bytes, operand);
+    for(u8 b : bytes)
+    {
+        emitByte(compiler, b);
+    }
+}
+
+// Emits a jump with a placeholder target, returns the offset to patch.
+static u32 emitJump(Compiler& compiler, OpCode op)
+{
+    emitOp(compiler, op, ~0u);
+    return compiler.mem.code.size() - sizeof(u32);
+}
+
+static void patchJump(Compiler& compiler, u32 operandOffset)
+{
+    writeOperand(&compiler.mem.code[operandOffset], compiler.mem.code.size());
+}
+
+static u32 addConstant(Compiler& compiler, const ExprValue& value)
+{
+    compiler.mem.constants.emplace_back(toValue(compiler.mem, value));
+    return compiler.mem.constants.size() - 1;
+}
+
+static void setLineFromToken(Compiler& compiler, u32 tokenIndex)
+{
+    if(tokenIndex < tokens_count(compiler.mem.tokens))
+    {
+        compiler.line = tokens_line(compiler.mem.tokens, tokenIndex);
+    }
+}
+
+static OpCode getBinaryOpCode(TokenType type)
+{
+    switch(type)
+    {
+        case TokenType::PLUS: return OpCode_Add;
+        case TokenType::MINUS: return OpCode_Subtract;
+        case TokenType::STAR: return OpCode_Multiply;
+        case TokenType::SLASH: return OpCode_Divide;
+        case TokenType::GREATER: return OpCode_Greater;
+        case TokenType::GREATER_EQUAL: return OpCode_GreaterEqual;
+        case TokenType::LESSER: return OpCode_Lesser;
+        case TokenType::LESSER_EQUAL: return OpCode_LesserEqual;
+        case TokenType::EQUAL_EQUAL: return OpCode_Equal;
+        case TokenType::BANG_EQUAL: return OpCode_NotEqual;
+        default: return OpCode_Count;
+    }
+}
+
+static void compileExpression(Compiler& compiler, u32 exprIndex)
+{
+    assert(exprIndex < compiler.mem.expressions.size());
+    const Expr& expr = compiler.mem.expressions[exprIndex];
+    switch(expr.exprType)
+    {
+        case ExprType_None:
+        {
+            compileError(compiler, "Expr type none!");
+        }
+        break;
+        case ExprType_Binary:
+        {
+            compileExpression(compiler, expr.leftExprIndex);
+            compileExpression(compiler, expr.rightExprIndex);
+            setLineFromToken(compiler, expr.tokenOperIndex);
+            OpCode op = getBinaryOpCode(getTokenOperType(compiler.mem, expr));
+            if(op == OpCode_Count)
+            {
+                compileError(compiler, "Not recognized binary operator!");
+                break;
+            }
+            // Proven operand types start out quickened, the vm still guards them.
+            StaticType leftType = typeInfer_exprType(compiler.mem, expr.leftExprIndex);
+            StaticType rightType = typeInfer_exprType(compiler.mem, expr.rightExprIndex);
+            if(leftType == StaticType_Int && rightType == StaticType_Int)
+            {
+                op = getIntOpCode(op);
+            }
+            else if(leftType == StaticType_Double && rightType == StaticType_Double)
+            {
+                op = getDoubleOpCode(op);
+            }
+            emitOp(compiler, op);
+        }
+        break;
+        case ExprType_Literal:
+        {
+            const ExprValue& value = compiler.mem.literals[expr.literalIndex];
+            switch(value.literalType)
+            {
+                case LiteralType_Null:
+                    emitOp(compiler, OpCode_Nil);
+                    break;
+                case LiteralType_Boolean:
+                    emitOp(compiler, value.value != 0 ? OpCode_True : OpCode_False);
+                    break;
+                default:
+                    emitOp(compiler, OpCode_Constant, addConstant(compiler, value));
+                    break;
+            }
+        }
+        break;
+        case ExprType_Unary:
+        {
+            compileExpression(compiler, expr.rightExprIndex);
+            setLineFromToken(compiler, expr.tokenOperIndex);
+            switch(getTokenOperType(compiler.mem, expr))
+            {
+                case TokenType::MINUS: emitOp(compiler, OpCode_Negate); break;
+                case TokenType::BANG: emitOp(compiler, OpCode_Not); break;
+                default: compileError(compiler, "Not recognized unary type!"); break;
+            }
+        }
+        break;
+        case ExprType_Variable:
+        {
+            setLineFromToken(compiler, expr.tokenOperIndex);
+            emitOp(compiler, expr.varDepth == VarDepth_Global ? OpCode_GetGlobal : OpCode_GetLocal, expr.varSlot);
+        }
+        break;
+        case ExprType_Assign:
+        {
+            compileExpression(compiler, expr.rightExprIndex);
+            setLineFromToken(compiler, expr.tokenOperIndex);
+            emitOp(compiler, expr.varDepth == VarDepth_Global ? OpCode_SetGlobal : OpCode_SetLocal, expr.varSlot);
+        }
+        break;
+        case ExprType_Logical:
+        {
+            compileExpression(compiler, expr.leftExprIndex);
+            bool isOr = getTokenOperType(compiler.mem, expr) == TokenType::OR;
+            u32 endJump = emitJump(compiler, isOr ? OpCode_JumpIfTrue : OpCode_JumpIfFalse);
+            emitOp(compiler, OpCode_Pop);
+            compileExpression(compiler, expr.rightExprIndex);
+            patchJump(compiler, endJump);
+        }
+        break;
+        case ExprType_CallFn:
+        {
+            compileExpression(compiler, expr.callee);
+            for(u32 i = 0; i < expr.argCount; ++i)
+            {
+                compileExpression(compiler, compiler.mem.callArgs[expr.argsStart + i]);
+            }
+            setLineFromToken(compiler, expr.tokenOperIndex);
+            emitOp(compiler, OpCode_Call, expr.argCount);
+        }
+        break;
+    }
+}
+
+static void compileStatements(Compiler& compiler, const std::vector<u32>& statementIndices)
+{
+    for(u32 index : statementIndices)
+    {
+        // Function declarations live in mem.functions and leave ~0 in the block.
+        if(index >= compiler.mem.statements.size())
+        {
+            continue;
+        }
+        compileStatement(compiler, index);
+    }
+}
+
+static void compileStatement(Compiler& compiler, u32 statementIndex)
+{
+    const Statement& statement = compiler.mem.statements[statementIndex];
+    switch(statement.type)
+    {
+        case StatementType_Expression:
+        {
+            compileExpression(compiler, statement.expressionIndex);
+            emitOp(compiler, OpCode_Pop);
+        }
+        break;
+        case StatementType_Print:
+        {
+            compileExpression(compiler, statement.expressionIndex);
+            emitOp(compiler, OpCode_Print);
+        }
+        break;
+        case StatementType_VarDeclare:
+        {
+            setLineFromToken(compiler, statement.tokenIndex);
+            compileExpression(compiler, statement.expressionIndex);
+            emitOp(compiler, statement.varDepth == VarDepth_Global ? OpCode_DefineGlobal : OpCode_DefineLocal,
+                statement.varSlot);
+        }
+        break;
+        case StatementType_Block:
+        {
+            compileStatements(compiler, compiler.mem.blocks[statement.blockIndex].statementIndices);
+        }
+        break;
+        case StatementType_If:
+        {
+            compileExpression(compiler, statement.expressionIndex);
+            u32 elseJump = emitJump(compiler, OpCode_JumpIfFalse);
+            emitOp(compiler, OpCode_Pop);
+            compileStatement(compiler, statement.ifStatementIndex);
+            u32 endJump = emitJump(compiler, OpCode_Jump);
+            patchJump(compiler, elseJump);
+            emitOp(compiler, OpCode_Pop);
+            if(statement.elseStatementIndex < compiler.mem.statements.size())
+            {
+                compileStatement(compiler, statement.elseStatementIndex);
+            }
+            patchJump(compiler, endJump);
+        }
+        break;
+        case StatementType_While:
+        {
+            u32 loopStart = compiler.mem.code.size();
+            compileExpression(compiler, statement.expressionIndex);
+            u32 exitJump = emitJump(compiler, OpCode_JumpIfFalse);
+            emitOp(compiler, OpCode_Pop);
+            compileStatement(compiler, statement.whileStatementIndex);
+            emitOp(compiler, OpCode_Jump, loopStart);
+            patchJump(compiler, exitJump);
+            emitOp(compiler, OpCode_Pop);
+        }
+        break;
+        case StatementType_CallFn:
+        {
+        }
+        break;
+        case StatementType_Return:
+        {
+            if(!compiler.inFunction)
+            {
+                compileError(compiler, "Cannot return from top-level code!");
+                break;
+            }
+            if(statement.expressionIndex == ~0u)
+            {
+                emitOp(compiler, OpCode_Constant, addConstant(compiler, ExprValue{}));
+            }
+            else
+            {
+                compileExpression(compiler, statement.expressionIndex);
+            }
+            emitOp(compiler, OpCode_Return);
+        }
+        break;
+        case StatementType_Count:
+        {
+            compileError(compiler, "Statement count");
+        }
+        break;
+    }
+}
+
+// Each function ends with an implicit return.
+static void compileFunction(Compiler& compiler, u32 fnIndex)
+{
+    MyMemory& mem = compiler.mem;
+    // Bodies are compiled apart from their declaration, the line starts over.
+    setLineFromToken(compiler, mem.functions[fnIndex].tokenNameIndex);
+    mem.functionEntries[fnIndex] = mem.code.size();
+    compileStatements(compiler, mem.blocks[mem.functions[fnIndex].blockIndex].statementIndices);
+    emitOp(compiler, OpCode_Constant, addConstant(compiler, ExprValue{}));
+    emitOp(compiler, OpCode_Return);
+}
+
+bool bytecode_compile(MyMemory& mem, bool printCode)
+{
+    Compiler compiler{.mem = mem, .line = 1, .inFunction = false, .hasErrors = false };
+
+    mem.code.clear();
+    mem.codeLines.clear();
+    mem.constants.clear();
+    mem.functionEntries.clear();
+
+    compileStatements(compiler, mem.blocks[0].statementIndices);
+    emitOp(compiler, OpCode_Halt);
+
+    // Functions follow the top-level code, skipped bodies are appended on their first call.
+    compiler.inFunction = true;
+    mem.functionEntries.assign(mem.functions.size(), ~0u);
+    for(u32 fnIndex = 0; fnIndex < mem.functions.size(); ++fnIndex)
+    {
+        if(mem.functions[fnIndex].blockIndex >= 0)
+        {
+            compileFunction(compiler, fnIndex);
+        }
+    }
+
+    if(printCode)
+    {
+        printBytecode(mem);
+    }
+    return !compiler.hasErrors;
+}
+
+bool bytecode_compileFunction(MyMemory& mem, u32 fnIndex)
+{
+    Compiler compiler{.mem = mem, .line = 1, .inFunction = true, .hasErrors = false };
+    compileFunction(compiler, fnIndex);
+    return !compiler.hasErrors;
+}
+
+u32 bytecode_compileMore(MyMemory& mem, const std::vector<u32>& statementIndices, bool echoExpressions)
+{
+    Compiler compiler{.mem = mem, .line = 1, .inFunction = false, .hasErrors = false };
+    u32 entry = mem.code.size();
+    for(u32 index : statementIndices)
+    {
+        if(index >= mem.statements.size())
+        {
+            continue;
+        }
+        const Statement& statement = mem.statements[index];
+        if(echoExpressions && statement.type == StatementType_Expression)
+        {
+            compileExpression(compiler, statement.expressionIndex);
+            emitOp(compiler, OpCode_Echo);
+        }
+        else
+        {
+            compileStatement(compiler, index);
+        }
+    }
+    emitOp(compiler, OpCode_Halt);
+
+    compiler.inFunction = true;
+    u32 firstFunction = mem.functionEntries.size();
+    mem.functionEntries.resize(mem.functions.size(), ~0u);
+    for(u32 fnIndex = firstFunction; fnIndex < mem.functions.size(); ++fnIndex)
+    {
+        if(mem.functions[fnIndex].blockIndex >= 0)
+        {
+            compileFunction(compiler, fnIndex);
+        }
+    }
+    // The functions are bound already, their code stays even when the input is not run.
+    return compiler.hasErrors ? ~0u : entry;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+
+#include "mytypes.h"
+
+struct MyMemory;
+
+// Lowers mem.statements / mem.expressions into the linear bytecode in mem.code.
+// Functions with skipped bodies get functionEntries ~0u.
+bool bytecode_compile(MyMemory& mem, bool printCode);
+// Appends a function parsed after bytecode_compile(), mem.code may move.
+bool bytecode_compileFunction(MyMemory& mem, u32 fnIndex);
+// Appends the code of statements added by ast_generateMore(), ending on a halt,
+// and the functions declared with them. echoExpressions prints the value of
+// top-level expression statements instead of dropping it. Returns the entry
+// offset for vm_runFrom(), ~0u on errors.
+u32 bytecode_compileMore(MyMemory& mem, const std::vector<u32>& statementIndices, bool echoExpressions);
@@ -11,7 +11,10 @@ void reportError(i32 line, const std::string& message, const std::string& where)
 void reportError(Scanner& scanner, const std::string& message, const std::string& where)
 {
     scanner.hasErrors = true;
-    reportError(scanner.line, message, where);
+    if(!scanner.silent)
+    {
+        reportError(scanner.line, message, where);
+    }
 }
 
 
@@ -25,7 +28,7 @@ void reportError(const MyMemory& mem, const Token& token, const std::string& mes
     {
         std::string s = " at end '";
         //s += token.lexMe;
-        s += getTokenValueAsString(mem, token);
+        s += getTokenLexeme(mem, token);
         s += "'";
         reportError(token.line, s, message);
     }
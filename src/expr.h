@@ -28,13 +28,20 @@ enum LiteralType : u32
     LiteralType_Double,
     LiteralType_String,
     LiteralType_Identifier,
+    LiteralType_Function,
 };
 
-enum ExprType : u32
+// Where a resolved variable lives, see resolver.h
+enum VarDepth : u8
+{
+    VarDepth_Local = 0,
+    VarDepth_Global = 1,
+};
+
+enum ExprType : u8
 {
     ExprType_None,
     ExprType_Binary,
-    ExprType_Grouping,
     ExprType_Literal,
     ExprType_Unary,
     ExprType_Variable,
@@ -50,34 +57,36 @@ struct ExprValue
         i64 value;
         double doubleValue;
         u32 stringIndex;
+        // Identifiers and token lexemes, see interner.h
+        u32 symbolIndex;
     };
     LiteralType literalType;
 };
+// 16 bytes, the type decides what the indices mean:
+//   Binary, Logical: leftExprIndex and rightExprIndex
+//   Unary:           rightExprIndex
+//   Literal:         literalIndex into mem.literals
+//   Variable:        varSlot, tokenOperIndex is the name
+//   Assign:          varSlot and rightExprIndex, tokenOperIndex is the name
+//   CallFn:          callee, the arguments are mem.callArgs[argsStart, argsStart + argCount)
 struct Expr
 {
+    u32 tokenOperIndex;
     union
     {
-        ExprValue exprValue;
-        u32 callParamAmount;
+        u32 leftExprIndex;
+        u32 literalIndex;
+        u32 varSlot;
+        u32 callee;
     };
-    u32 tokenOperIndex;
     union
     {
-        struct
-        {
-            //u32 secondTokenIndex;
-
-            u32 leftExprIndex;
-            u32 rightExprIndex;
-        };
-        struct
-        {
-            u32 callParams[4];
-            u32 callee;
-        };
+        u32 rightExprIndex;
+        u32 argsStart;
     };
-    //u32 myExprIndex;
-
     ExprType exprType;
+    // Variable and assign, filled by the resolver.
+    VarDepth varDepth;
+    u16 argCount;
 };
-
+static_assert(sizeof(Expr) == 16);
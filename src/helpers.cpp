@@ -11,8 +11,7 @@
 
 u32 addToken(MyMemory& mem, const Token& token)
 {
-    mem.tokens.emplace_back(token);
-    return mem.tokens.size() - 1;
+    return tokens_add(mem.tokens, token);
 }
 
 u32 addExpr(MyMemory& mem, const Expr& expr)
@@ -22,10 +21,15 @@ u32 addExpr(MyMemory& mem, const Expr& expr)
     return mem.expressions.size() - 1;
 }
 
+u32 addLiteral(MyMemory& mem, const ExprValue& value)
+{
+    mem.literals.emplace_back(value);
+    return mem.literals.size() - 1;
+}
+
 u32 addString(MyMemory& mem, const std::string& str)
 {
-    mem.strings.emplace_back(str);
-    return mem.strings.size() - 1;
+    return stringHeap_intern(mem, std::string(str));
 }
 
 u32 addStatement(MyMemory& mem, const Statement& statement)
@@ -40,9 +44,14 @@ u32 addStatement(MyMemory& mem, const Statement& statement)
 
 }
 
-const Token& getTokenOper(const MyMemory& mem, const Expr& expr)
+Token getTokenOper(const MyMemory& mem, const Expr& expr)
+{
+    return tokens_get(mem.tokens, expr.tokenOperIndex);
+}
+
+TokenType getTokenOperType(const MyMemory& mem, const Expr& expr)
 {
-    return mem.tokens[expr.tokenOperIndex];
+    return tokens_type(mem.tokens, expr.tokenOperIndex);
 }
 
 const Expr& getLeftExprValue(const MyMemory& mem, const Expr& expr)
@@ -91,112 +100,273 @@ std::string stringify(const MyMemory& mem, const ExprValue& exprValue)
         case LiteralType_Double:
             return std::to_string(exprValue.doubleValue);
         case LiteralType_String:
-            return getConstString(mem, exprValue);
+        {
+            std::string s;
+            stringHeap_append(mem, exprValue.stringIndex, s);
+            return s;
+        }
+        case LiteralType_Function:
+            return "<fn " + std::string(getTokenLexeme(mem, mem.functions[exprValue.stringIndex].tokenNameIndex)) + ">";
     }
 
     reportError(-1, "Literal type unknown", "");
     DEBUG_BREAK_MACRO(-5);
 }
 
-const ExprValue& getConstValue(const MyMemory& mem, const std::string& findName, u32 blockIndex)
+void printValue(const MyMemory& mem, const ExprValue& exprValue)
 {
-    const Block& block = mem.blocks[blockIndex];
-    auto iter = block.variables.find(findName);
-    if(iter == block.variables.end())
+    if(exprValue.literalType == LiteralType_String)
     {
-        if(block.parentBlockIndex >= 0 && block.parentBlockIndex < mem.blocks.size())
-        {
-            return getConstValue(mem, findName, block.parentBlockIndex);
-        }
-
-        reportError(mem, Token{}, "Variable not found!");
-        DEBUG_BREAK_MACRO(20);
+        stringHeap_write(mem, exprValue.stringIndex, stdout);
+        putchar('\n');
+        return;
     }
-    return iter->second;
-
+    printf("%s\n", stringify(mem, exprValue).data());
 }
-const ExprValue& getConstValue(const MyMemory& mem, u32 stringIndex)
+
+static constexpr i64 NegFull = ~i64(0);
+
+bool isTruthy(const MyMemory& mem, const ExprValue& value)
 {
-    const std::string &findName = mem.strings[stringIndex];
-    return getConstValue(mem, findName, mem.currentBlockIndex);
+    switch(value.literalType)
+    {
+        case LiteralType_Null:
+        case LiteralType_None:
+            return false;
+        case LiteralType_Double:
+        case LiteralType_I64:
+        case LiteralType_Boolean:
+            return value.value != 0;
+        case LiteralType_String:
+            return stringHeap_length(mem, value.stringIndex) != 0;
+        case LiteralType_Function:
+            return true;
+    }
+    return false;
 }
-const ExprValue& getConstValue(const MyMemory& mem, const ExprValue& exprValue)
+
+ExprValue doDoubleOperOnBinary(TokenType type, double a, double b)
 {
-    return getConstValue(mem, exprValue.stringIndex);
+    ExprValue value{.literalType = LiteralType_Double };
+
+    switch(type)
+    {
+        case TokenType::MINUS:
+            value.doubleValue = a - b;
+            break;
+        case TokenType::PLUS:
+            value.doubleValue = a + b;
+            break;
+        case TokenType::STAR:
+            value.doubleValue = a * b;
+            break;
+        case TokenType::SLASH:
+            value.doubleValue = a / b;
+            break;
+
+        case TokenType::GREATER:
+            value.value = a > b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        case TokenType::GREATER_EQUAL:
+            value.value = a >= b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        case TokenType::LESSER:
+            value.value = a < b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        case TokenType::LESSER_EQUAL:
+            value.value = a <= b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        case TokenType::BANG_EQUAL:
+            value.value = a != b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        case TokenType::EQUAL_EQUAL:
+            value.value = a == b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        default:
+            value.value = NegFull;
+            value.literalType = LiteralType_None;
+    }
+    return value;
 }
-const ExprValue& getConstValue(const MyMemory& mem, const Token& token)
+
+ExprValue doIntOperOnBinary(TokenType type, i64 a, i64 b)
 {
-    return getConstValue(mem, token.value);
+    ExprValue value{.literalType = LiteralType_I64 };
+
+    switch(type)
+    {
+        case TokenType::MINUS:
+            value.value = a - b;
+            break;
+        case TokenType::PLUS:
+            value.value = a + b;
+            break;
+        case TokenType::STAR:
+            value.value = a * b;
+            break;
+        case TokenType::SLASH:
+            value.value = a / b;
+            break;
+
+        case TokenType::GREATER:
+            value.value = a > b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        case TokenType::GREATER_EQUAL:
+            value.value = a >= b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        case TokenType::LESSER:
+            value.value = a < b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        case TokenType::LESSER_EQUAL:
+            value.value = a <= b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        case TokenType::BANG_EQUAL:
+            value.value = a != b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        case TokenType::EQUAL_EQUAL:
+            value.value = a == b ? NegFull : 0;
+            value.literalType = LiteralType_Boolean;
+            break;
+        default:
+            value.value = NegFull;
+            value.literalType = LiteralType_None;
+    }
+    return value;
 }
 
-ExprValue& getMutableValue(MyMemory& mem, const std::string& findName, u32 blockIndex)
+ExprValue doStringOperOnBinary(MyMemory& mem, TokenType type, u32 a, u32 b)
 {
-    Block& block = mem.blocks[blockIndex];
-    auto iter = block.variables.find(findName);
-    if(iter == block.variables.end())
-    {
-        if(block.parentBlockIndex >= 0 && block.parentBlockIndex < mem.blocks.size())
-        {
-            return getMutableValue(mem, findName, block.parentBlockIndex);
-        }
+    ExprValue value{.literalType = LiteralType_Boolean };
 
-        reportError(mem, Token{}, "Variable not found!");
-        DEBUG_BREAK_MACRO(20);
+    switch(type)
+    {
+        case TokenType::EQUAL_EQUAL:
+            value.value = stringHeap_equal(mem, a, b) ? NegFull : 0;
+            break;
+        case TokenType::BANG_EQUAL:
+            value.value = stringHeap_equal(mem, a, b) ? 0 : NegFull;
+            break;
+        case TokenType::GREATER:
+            value.value = stringHeap_compare(mem, a, b) > 0 ? NegFull : 0;
+            break;
+        case TokenType::GREATER_EQUAL:
+            value.value = stringHeap_compare(mem, a, b) >= 0 ? NegFull : 0;
+            break;
+        case TokenType::LESSER:
+            value.value = stringHeap_compare(mem, a, b) < 0 ? NegFull : 0;
+            break;
+        case TokenType::LESSER_EQUAL:
+            value.value = stringHeap_compare(mem, a, b) <= 0 ? NegFull : 0;
+            break;
+        default:
+            value.value = NegFull;
+            value.literalType = LiteralType_None;
     }
-    return iter->second;
+    return value;
+}
 
+bool checkNumber(Value value)
+{
+    return isInt(value) || isDouble(value);
+}
+
+bool checkString(Value value)
+{
+    return isString(value);
 }
 
-ExprValue& getMutableValue(MyMemory& mem, u32 stringIndex)
+double getDouble(const MyMemory& mem, Value value)
 {
-    const std::string& findName = mem.strings[stringIndex];
-    return getMutableValue(mem, findName, mem.currentBlockIndex);
+    return isDouble(value) ? asDouble(value) : (double)asInt(mem, value);
 }
-ExprValue& getMutableValue(MyMemory& mem, const ExprValue& exprValue)
+
+std::string stringify(const MyMemory& mem, Value value)
 {
-    return getMutableValue(mem, exprValue.stringIndex);
+    return stringify(mem, toExprValue(mem, value));
 }
-ExprValue& getMutableValue(MyMemory& mem, const Token& token)
+
+void printValue(const MyMemory& mem, Value value)
 {
-    return getMutableValue(mem, token.value);
+    printValue(mem, toExprValue(mem, value));
 }
 
-void defineVariable(MyMemory& mem, const std::string& name, const ExprValue& value)
+bool isTruthy(const MyMemory& mem, Value value)
 {
-    Block& b = mem.blocks[mem.currentBlockIndex];
-    auto iter = b.variables.find(name);
-    if(iter != b.variables.end())
+    if(isDouble(value))
     {
-        reportError(-12, "Variable already exists!", "");
+        // Same as the ExprValue version, any set bit is true.
+        double d = asDouble(value);
+        u64 bits;
+        memcpy(&bits, &d, sizeof(double));
+        return bits != 0;
+    }
+    if(isInt(value))
+        return asInt(mem, value) != 0;
+    if(isBool(value))
+        return asBool(value);
+    if(isString(value))
+        return stringHeap_length(mem, asStringIndex(value)) != 0;
+    return isFunction(value);
+}
+
+ExprValue& getGlobal(MyMemory& mem, u32 slot)
+{
+    assert(slot < mem.globals.size());
+    ExprValue& value = mem.globals[slot];
+    if(value.literalType == LiteralType_None)
+    {
+        reportError(-1, "Variable not found: '" + std::string(getSymbolName(mem, mem.globalNames[slot])) + "'", "at runtime");
         DEBUG_BREAK_MACRO(20);
     }
-    b.variables.insert({name, value});
+    return value;
 }
 
-std::string& getMutableString(MyMemory& mem, const Token& token)
+ExprValue& getLocal(MyMemory& mem, u32 slot)
 {
-    assert(token.type == TokenType::IDENTIFIER);
-    assert(token.value.stringIndex < mem.strings.size());
-    return mem.strings[token.value.stringIndex];
+    assert(mem.callStack.frameBase + slot < mem.callStack.slotTop);
+    return mem.callStack.slots[mem.callStack.frameBase + slot];
 }
 
-std::string& getMutableString(MyMemory& mem, const ExprValue& exprValue)
+ExprValue& getVariable(MyMemory& mem, VarDepth depth, u32 slot)
 {
-    assert(exprValue.literalType == LiteralType_Identifier || exprValue.literalType == LiteralType_String);
-    assert(exprValue.stringIndex < mem.strings.size());
-    return mem.strings[exprValue.stringIndex];
+    return depth == VarDepth_Global ? getGlobal(mem, slot) : getLocal(mem, slot);
 }
 
-const std::string& getConstString(const MyMemory& mem, const Token& token)
+void defineVariable(MyMemory& mem, VarDepth depth, u32 slot, const ExprValue& value)
 {
-    assert(token.type == TokenType::IDENTIFIER);
-    assert(token.value.stringIndex < mem.strings.size());
-    return mem.strings[token.value.stringIndex];
+    if(depth == VarDepth_Global)
+        mem.globals[slot] = value;
+    else
+        getLocal(mem, slot) = value;
+}
+
+std::string_view getSymbolName(const MyMemory& mem, u32 symbolIndex)
+{
+    assert(symbolIndex < mem.symbols.symbols.size());
+    return interner_get(mem.symbols, symbolIndex);
+}
+
+std::string& getMutableString(MyMemory& mem, const ExprValue& exprValue)
+{
+    assert(exprValue.literalType == LiteralType_String);
+    assert(exprValue.stringIndex < mem.strings.size());
+    return mem.strings[exprValue.stringIndex];
 }
 
 const std::string& getConstString(const MyMemory& mem, const ExprValue& exprValue)
 {
-    assert(exprValue.literalType == LiteralType_Identifier || exprValue.literalType == LiteralType_String);
+    assert(exprValue.literalType == LiteralType_String);
     assert(exprValue.stringIndex < mem.strings.size());
     return mem.strings[exprValue.stringIndex];
 }
@@ -2,15 +2,19 @@
 
 #include "mymemory.h"
 #include "mytypes.h"
+#include "value.h"
 
 #include <string>
 
 u32 addToken(MyMemory& mem, const Token& token);
 u32 addExpr(MyMemory& mem, const Expr& expr);
+u32 addLiteral(MyMemory& mem, const ExprValue& value);
 u32 addString(MyMemory& mem, const std::string& str);
 u32 addStatement(MyMemory& mem, const Statement& statement);
 
-const Token& getTokenOper(const MyMemory& mem, const Expr& expr);
+// Gathers the token, prefer getTokenOperType() on hot paths.
+Token getTokenOper(const MyMemory& mem, const Expr& expr);
+TokenType getTokenOperType(const MyMemory& mem, const Expr& expr);
 const Expr& getLeftExprValue(const MyMemory& mem, const Expr& expr);
 const Expr& getRightExpr(const MyMemory& mem, const Expr& expr);
 
@@ -21,17 +25,29 @@ double getDouble(const ExprValue& exprValue);
 i64 getInt(const ExprValue& exprValue);
 
 std::string stringify(const MyMemory& mem, const ExprValue& exprValue);
-
-const ExprValue& getConstValue(const MyMemory& mem, u32 stringIndex);
-const ExprValue& getConstValue(const MyMemory& mem, const ExprValue& exprValue);
-const ExprValue& getConstValue(const MyMemory& mem, const Token& token);
-ExprValue& getMutableValue(MyMemory& mem, u32 stringIndex);
-ExprValue& getMutableValue(MyMemory& mem, const ExprValue& exprValue);
-ExprValue& getMutableValue(MyMemory& mem, const Token& token);
-void defineVariable(MyMemory& mem, const std::string& name, const ExprValue& value);
-
-const std::string& getConstString(const MyMemory& mem, const Token& token);
+// What print shows, strings are written without copying a rope together.
+void printValue(const MyMemory& mem, const ExprValue& exprValue);
+
+bool isTruthy(const MyMemory& mem, const ExprValue& value);
+ExprValue doDoubleOperOnBinary(TokenType type, double a, double b);
+ExprValue doIntOperOnBinary(TokenType type, i64 a, i64 b);
+// Comparisons only, + concatenates in the runtimes since it may collect.
+ExprValue doStringOperOnBinary(MyMemory& mem, TokenType type, u32 a, u32 b);
+
+bool checkNumber(Value value);
+bool checkString(Value value);
+double getDouble(const MyMemory& mem, Value value);
+std::string stringify(const MyMemory& mem, Value value);
+void printValue(const MyMemory& mem, Value value);
+bool isTruthy(const MyMemory& mem, Value value);
+
+ExprValue& getGlobal(MyMemory& mem, u32 slot);
+ExprValue& getLocal(MyMemory& mem, u32 slot);
+ExprValue& getVariable(MyMemory& mem, VarDepth depth, u32 slot);
+void defineVariable(MyMemory& mem, VarDepth depth, u32 slot, const ExprValue& value);
+
+std::string_view getSymbolName(const MyMemory& mem, u32 symbolIndex);
+
+// Flat strings only, runtime concatenations may be ropes, see stringheap.h
 const std::string& getConstString(const MyMemory& mem, const ExprValue& exprValue);
-
-std::string& getMutableString(MyMemory& mem, const Token& token);
 std::string& getMutableString(MyMemory& mem, const ExprValue& exprValue);
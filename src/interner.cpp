@@ -0,0 +1,93 @@
+#include "interner.h"
+
+#include <string.h>
+
+static constexpr u32 InitialTableSize = 1024;
+
+u32 interner_hash(const char* str, u32 length)
+{
+    // FNV-1a
+    u32 hash = 2166136261u;
+    for(u32 i = 0; i < length; ++i)
+    {
+        hash ^= (u8)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static u32 findBucket(const Interner& interner, const char* str, u32 length, u32 hash)
+{
+    u32 mask = interner.table.size() - 1;
+    for(u32 bucket = hash & mask;; bucket = (bucket + 1) & mask)
+    {
+        u32 entry = interner.table[bucket];
+        if(entry == 0)
+        {
+            return bucket;
+        }
+        const Symbol& symbol = interner.symbols[entry - 1];
+        if(symbol.hash == hash && symbol.length == length
+            && memcmp(&interner.chars[symbol.offset], str, length) == 0)
+        {
+            return bucket;
+        }
+    }
+}
+
+static void growTable(Interner& interner)
+{
+    u32 newSize = interner.table.empty() ? InitialTableSize : interner.table.size() * 2;
+    interner.table.assign(newSize, 0);
+    u32 mask = newSize - 1;
+    for(u32 i = 0; i < interner.symbols.size(); ++i)
+    {
+        u32 bucket = interner.symbols[i].hash & mask;
+        while(interner.table[bucket] != 0)
+        {
+            bucket = (bucket + 1) & mask;
+        }
+        interner.table[bucket] = i + 1;
+    }
+}
+
+u32 interner_add(Interner& interner, const char* str, u32 length)
+{
+    if(interner.table.empty())
+    {
+        growTable(interner);
+        interner.symbols.push_back(Symbol{.offset = 0, .length = 0, .hash = interner_hash("", 0) });
+        interner.chars.push_back('\0');
+        interner.table[interner.symbols[0].hash & (interner.table.size() - 1)] = 1;
+    }
+
+    u32 hash = interner_hash(str, length);
+    u32 bucket = findBucket(interner, str, length, hash);
+    if(interner.table[bucket] != 0)
+    {
+        return interner.table[bucket] - 1;
+    }
+
+    u32 symbol = interner.symbols.size();
+    interner.symbols.push_back(Symbol{.offset = (u32)interner.chars.size(), .length = length, .hash = hash });
+    interner.chars.insert(interner.chars.end(), str, str + length);
+    interner.chars.push_back('\0');
+    interner.table[bucket] = symbol + 1;
+
+    // Keep load factor under one half.
+    if(interner.symbols.size() * 2 > interner.table.size())
+    {
+        growTable(interner);
+    }
+    return symbol;
+}
+
+u32 interner_find(const Interner& interner, const char* str, u32 length)
+{
+    if(interner.table.empty())
+    {
+        return ~0u;
+    }
+    u32 bucket = findBucket(interner, str, length, interner_hash(str, length));
+    return interner.table[bucket] != 0 ? interner.table[bucket] - 1 : ~0u;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "mytypes.h"
+
+struct Symbol
+{
+    u32 offset;
+    u32 length;
+    u32 hash;
+};
+
+// Deduplicates lexemes into one contiguous, null terminated char arena.
+// Symbol ids are stable, equal text always gives the same id so names can be
+// compared and hashed as integers. Symbol 0 is the empty string.
+struct Interner
+{
+    std::vector<char> chars;
+    std::vector<Symbol> symbols;
+    // Open addressing, holds symbol id + 1, 0 marks an empty bucket.
+    std::vector<u32> table;
+};
+
+u32 interner_hash(const char* str, u32 length);
+u32 interner_add(Interner& interner, const char* str, u32 length);
+// Returns ~0u when the text has not been interned.
+u32 interner_find(const Interner& interner, const char* str, u32 length);
+
+// The view is invalidated by the next interner_add().
+static std::string_view interner_get(const Interner& interner, u32 symbol)
+{
+    const Symbol& s = interner.symbols[symbol];
+    return std::string_view(&interner.chars[s.offset], s.length);
+}
@@ -1,140 +1,52 @@
 #include "interpreter.h"
 
+#include "astparser.h"
 #include "errors.h"
 #include "expr.h"
 #include "helpers.h"
 #include "mymemory.h"
 #include "token.h"
+#include "typeinfer.h"
 
 #include <assert.h>
 #include <cmath>
 #include <string>
 
-static constexpr i64 NegFull = ~i64(0);
+static ExprValue evaluate(MyMemory& mem, const Expr& expr);
 
-static bool isTruthy(const MyMemory& mem, const ExprValue& value)
+static ExprValue evaluate(MyMemory& mem, u32 exprIndex)
 {
-    switch(value.literalType)
-    {
-        case LiteralType_Null:
-        case LiteralType_None:
-            return false;
-        case LiteralType_Double:
-        case LiteralType_I64:
-        case LiteralType_Boolean:
-            return value.value != 0;
-        case LiteralType_String:
-            return !mem.strings[value.stringIndex].empty();
-    }
-    return false;
+    assert(exprIndex < mem.expressions.size());
+    return evaluate(mem, mem.expressions[exprIndex]);
 }
 
-static ExprValue doDoubleOperOnBinary(TokenType type, double a, double b)
+// Makes room for size more string bytes from an operation on left and right,
+// collecting first when the heap asks for it. Values held across an evaluate()
+// are in the call stack slots or pinned, see ExprType_Binary.
+static void reserveStrings(MyMemory& mem, const Expr& expr, u32 left, u32 right, u64 size)
 {
-    ExprValue value{.literalType = LiteralType_Double };
-
-    switch(type)
+    if(stringHeap_wantsCollection(mem, size))
     {
-        case TokenType::MINUS:
-            value.doubleValue = a - b;
-            break;
-        case TokenType::PLUS:
-            value.doubleValue = a + b;
-            break;
-        case TokenType::STAR:
-            value.doubleValue = a * b;
-            break;
-        case TokenType::SLASH:
-            value.doubleValue = a / b;
-            break;
-
-        case TokenType::GREATER:
-            value.value = a > b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        case TokenType::GREATER_EQUAL:
-            value.value = a >= b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        case TokenType::LESSER:
-            value.value = a < b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        case TokenType::LESSER_EQUAL:
-            value.value = a <= b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        case TokenType::BANG_EQUAL:
-            value.value = a != b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        case TokenType::EQUAL_EQUAL:
-            value.value = a == b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        default:
-            value.value = NegFull;
-            value.literalType = LiteralType_None;
+        stringHeap_beginCollection(mem);
+        stringHeap_mark(mem, left);
+        stringHeap_mark(mem, right);
+        for(u32 i = 0; i < mem.callStack.slotTop; ++i)
+        {
+            stringHeap_mark(mem, mem.callStack.slots[i]);
+        }
+        stringHeap_sweep(mem);
     }
-    return value;
-}
-
-static ExprValue doIntOperOnBinary(TokenType type, i64 a, i64 b)
-{
-    ExprValue value{.literalType = LiteralType_I64 };
-
-    switch(type)
+    if(!stringHeap_fits(mem, size))
     {
-        case TokenType::MINUS:
-            value.value = a - b;
-            break;
-        case TokenType::PLUS:
-            value.value = a + b;
-            break;
-        case TokenType::STAR:
-            value.value = a * b;
-            break;
-        case TokenType::SLASH:
-            value.value = a / b;
-            break;
-
-        case TokenType::GREATER:
-            value.value = a > b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        case TokenType::GREATER_EQUAL:
-            value.value = a >= b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        case TokenType::LESSER:
-            value.value = a < b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        case TokenType::LESSER_EQUAL:
-            value.value = a <= b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        case TokenType::BANG_EQUAL:
-            value.value = a != b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        case TokenType::EQUAL_EQUAL:
-            value.value = a == b ? NegFull : 0;
-            value.literalType = LiteralType_Boolean;
-            break;
-        default:
-            value.value = NegFull;
-            value.literalType = LiteralType_None;
+        reportError(mem, getTokenOper(mem, expr), "String heap limit exceeded!");
+        DEBUG_BREAK_MACRO(-4);
     }
-    return value;
 }
 
-static ExprValue evaluate(MyMemory& mem, const Expr& expr);
-
-static ExprValue evaluate(MyMemory& mem, u32 exprIndex)
+static u32 concatStrings(MyMemory& mem, const Expr& expr, u32 left, u32 right)
 {
-    assert(exprIndex < mem.expressions.size());
-    return evaluate(mem, mem.expressions[exprIndex]);
+    reserveStrings(mem, expr, left, right, stringHeap_concatBytes(mem, left, right));
+    return stringHeap_concat(mem, left, right);
 }
 
 static ExprValue evaluate(MyMemory& mem, const Expr& expr)
@@ -150,76 +62,102 @@ static ExprValue evaluate(MyMemory& mem, const Expr& expr)
         case ExprType_Binary:
         {
             const ExprValue& leftValue = evaluate(mem, getLeftExprValue(mem, expr));
+            // The right side may create strings, a collection must not free the left one.
+            bool pinLeft = leftValue.literalType == LiteralType_String;
+            if(pinLeft)
+            {
+                mem.stringHeap.pinned.push_back(leftValue.stringIndex);
+            }
             const ExprValue& rightValue = evaluate(mem, getRightExpr(mem, expr));
-            const Token& token = getTokenOper(mem, expr);
+            if(pinLeft)
+            {
+                mem.stringHeap.pinned.pop_back();
+            }
+            TokenType operType = getTokenOperType(mem, expr);
+
+            // Operand types proven by typeInfer_run() need no checks.
+            StaticType leftType = typeInfer_exprType(mem, expr.leftExprIndex);
+            StaticType rightType = typeInfer_exprType(mem, expr.rightExprIndex);
+            if(leftType == StaticType_Int && rightType == StaticType_Int)
+            {
+                return doIntOperOnBinary(operType, leftValue.value, rightValue.value);
+            }
+            if(leftType == StaticType_Double && rightType == StaticType_Double)
+            {
+                return doDoubleOperOnBinary(operType, leftValue.doubleValue, rightValue.doubleValue);
+            }
 
             if(checkNumber(leftValue) && checkNumber(rightValue))
             {
                 if(leftValue.literalType == LiteralType_Double || rightValue.literalType == LiteralType_Double)
-                    return doDoubleOperOnBinary(token.type, getDouble(leftValue), getDouble(rightValue));
-                return doIntOperOnBinary(token.type, getInt(leftValue), getInt(rightValue) );
+                    return doDoubleOperOnBinary(operType, getDouble(leftValue), getDouble(rightValue));
+                return doIntOperOnBinary(operType, getInt(leftValue), getInt(rightValue) );
             }
             else if(checkString(leftValue) && checkString(rightValue))
             {
-                ExprValue newValue {.literalType = LiteralType_String };
-                std::string s = mem.strings[leftValue.stringIndex];
-                s += mem.strings[rightValue.stringIndex];
-                newValue.stringIndex = addString(mem, s);
-
-                return newValue;
-
+                if(operType == TokenType::PLUS)
+                {
+                    ExprValue newValue {.literalType = LiteralType_String };
+                    newValue.stringIndex = concatStrings(mem, expr, leftValue.stringIndex, rightValue.stringIndex);
+                    return newValue;
+                }
+                // Comparing flattens ropes.
+                bool equalityOnly = operType == TokenType::EQUAL_EQUAL || operType == TokenType::BANG_EQUAL;
+                reserveStrings(mem, expr, leftValue.stringIndex, rightValue.stringIndex,
+                    stringHeap_compareBytes(mem, leftValue.stringIndex, rightValue.stringIndex, equalityOnly));
+                ExprValue value = doStringOperOnBinary(mem, operType, leftValue.stringIndex, rightValue.stringIndex);
+                if(value.literalType == LiteralType_None)
+                {
+                    reportError(mem, getTokenOper(mem, expr), "Strings only support + and comparisons");
+                    DEBUG_BREAK_MACRO(-4);
+                }
+                return value;
             }
             else
             {
-                reportError(mem, token, "Left and Right values aren't matching");
+                reportError(mem, getTokenOper(mem, expr), "Left and Right values aren't matching");
                 DEBUG_BREAK_MACRO(-4);
             }
         }
         break;
 
-        case ExprType_Grouping:
-        {
-
-        }
-        break;
         case ExprType_Literal:
         {
-            return expr.exprValue;
+            return mem.literals[expr.literalIndex];
         }
         case ExprType_Unary:
         {
-            const ExprValue& exprValue = getRightExpr(mem, expr).exprValue;
-            const Token& token = getTokenOper(mem, expr);
-            i64 value = exprValue.value;
-            switch(token.type)
+            const ExprValue& exprValue = evaluate(mem, getRightExpr(mem, expr));
+            TokenType operType = getTokenOperType(mem, expr);
+            switch(operType)
             {
                 case TokenType::MINUS:
                     if(!checkNumber(exprValue))
                     {
-                        reportError(mem, token, "Unary not number");
+                        reportError(mem, getTokenOper(mem, expr), "Unary not number");
                         DEBUG_BREAK_MACRO(-3);
                     }
-                    value = -value;
-                    break;
+                    if(exprValue.literalType == LiteralType_Double)
+                        return ExprValue{ .doubleValue = -exprValue.doubleValue, .literalType = LiteralType_Double };
+                    return ExprValue{ .value = -exprValue.value, .literalType = LiteralType_I64 };
                 case TokenType::BANG:
-                    value = value == 0 ? ~(i64(0)) : 0;
-                    break;
+                    return ExprValue{ .value = isTruthy(mem, exprValue) ? 0 : ~(i64(0)), .literalType = LiteralType_Boolean };
                 default:
-                    reportError(mem, token, "Not recognized unary type!");
+                    reportError(mem, getTokenOper(mem, expr), "Not recognized unary type!");
                     DEBUG_BREAK_MACRO(-4);
             }
-            return ExprValue{ .value = value, .literalType = expr.exprValue.literalType };
         }
+        break;
         case ExprType_Variable:
         {
-            return getConstValue(mem, expr.exprValue);
+            return getVariable(mem, expr.varDepth, expr.varSlot);
         }
 
         case ExprType_Assign:
         {
             const ExprValue& rightValue = evaluate(mem, getRightExpr(mem, expr));
 
-            ExprValue& mutableValue = getMutableValue(mem, expr.exprValue);
+            ExprValue& mutableValue = getVariable(mem, expr.varDepth, expr.varSlot);
             mutableValue = rightValue;
             return mutableValue;
         }
@@ -227,13 +165,13 @@ static ExprValue evaluate(MyMemory& mem, const Expr& expr)
         case ExprType_Logical:
         {
             const ExprValue& leftValue = evaluate(mem, getLeftExprValue(mem, expr));
-            const Token& token = getTokenOper(mem, expr);
+            TokenType operType = getTokenOperType(mem, expr);
             bool leftTruthy = isTruthy(mem, leftValue);
-            if(token.type == TokenType::OR && leftTruthy)
+            if(operType == TokenType::OR && leftTruthy)
             {
                 return leftValue;
             }
-            else if(token.type == TokenType::AND && !leftTruthy)
+            else if(operType == TokenType::AND && !leftTruthy)
             {
                 return leftValue;
             }
@@ -244,36 +182,58 @@ static ExprValue evaluate(MyMemory& mem, const Expr& expr)
         case ExprType_CallFn:
         {
             const ExprValue& calleeValue = evaluate(mem, expr.callee);
+            if(calleeValue.literalType != LiteralType_Function)
+            {
+                reportError(mem, getTokenOper(mem, expr), "Can only call functions!");
+                DEBUG_BREAK_MACRO(-4);
+            }
             const Statement& statement = mem.functions[calleeValue.stringIndex];
+            if(statement.blockIndex < 0 && !ast_parseFunction(mem, calleeValue.stringIndex))
+            {
+                reportError(mem, getTokenOper(mem, expr), "Failed to parse function!");
+                DEBUG_BREAK_MACRO(-4);
+            }
 
-            assert(expr.callParamAmount == statement.paramsNameIndicesCount);
-
-            u32 currentBlockIndex = mem.currentBlockIndex;
-            mem.blocks.emplace_back(Block{.parentBlockIndex = 0 });
-            u32 newBlockIndex = mem.blocks.size() - 1;
-
-            const Block& b = mem.blocks[statement.blockIndex];
+            assert(expr.argCount == statement.paramsCount);
 
-            for(u32 i = 0; i < statement.paramsNameIndicesCount; ++i)
+            // Arguments are evaluated in the caller frame and land in the slots the
+            // new frame starts with. Each one is reserved right away so calls made by
+            // the next argument push their frames above it.
+            CallStack& callStack = mem.callStack;
+            u32 argsBase = callStack.slotTop;
+            for(u32 i = 0; i < statement.paramsCount; ++i)
             {
-                const Token& t = mem.tokens[statement.paramsNameIndices[i]];
-                const std::string& str = mem.strings[t.value.stringIndex];
-                const ExprValue& evalued = evaluate(mem, expr.callParams[i]);
-                mem.blocks[newBlockIndex].variables.insert({str, evalued});
+                ExprValue arg = evaluate(mem, mem.callArgs[expr.argsStart + i]);
+                if(callStack.slotTop >= callStack.slots.size())
+                {
+                    reportError(mem, getTokenOper(mem, expr), "Stack overflow!");
+                    DEBUG_BREAK_MACRO(-4);
+                }
+                callStack.slots[callStack.slotTop++] = arg;
             }
+            callStack.slotTop = argsBase;
 
-            mem.currentBlockIndex = newBlockIndex ;
+            u32 callExprIndex = &expr - mem.expressions.data();
+            CallFrame* frame = callStack_push(callStack, callExprIndex, calleeValue.stringIndex, statement.localSlotCount);
+            if(frame == nullptr)
+            {
+                reportError(mem, getTokenOper(mem, expr), "Stack overflow!");
+                DEBUG_BREAK_MACRO(-4);
+            }
 
-            for(u32 index : b.statementIndices)
+            ExprValue value{};
+            for(u32 index : mem.blocks[statement.blockIndex].statementIndices)
             {
-                interpret(mem, mem.statements[index]);
-                if(mem.blocks[newBlockIndex].variables.contains("returnValue"))
+                if(index >= mem.statements.size())
+                    continue;
+                ExecResult result = interpret(mem, mem.statements[index]);
+                if(result.status == ExecStatus_Return)
+                {
+                    value = result.value;
                     break;
+                }
             }
-            ExprValue value = mem.blocks[newBlockIndex].variables["returnValue"];
-            mem.currentBlockIndex = currentBlockIndex;
-
-            mem.blocks.pop_back();
+            callStack_pop(mem.callStack);
             //interpret(mem, mem.statements[calleeValue.stringIndex]);
 
 
@@ -287,9 +247,8 @@ static ExprValue evaluate(MyMemory& mem, const Expr& expr)
 }
 
 
-void interpret(MyMemory& mem, const Statement& statement)
+ExecResult interpret(MyMemory& mem, const Statement& statement)
 {
-    std::string s;
     switch(statement.type)
     {
         case StatementType_Expression:
@@ -300,27 +259,28 @@ void interpret(MyMemory& mem, const Statement& statement)
         break;
         case StatementType_Block:
         {
-            Block& b = mem.blocks[statement.blockIndex];
-            mem.currentBlockIndex = statement.blockIndex;
-            b.variables.clear();
-            for(u32 index : b.statementIndices)
+            // Block locals already have their own frame slots from the resolver.
+            for(u32 index : mem.blocks[statement.blockIndex].statementIndices)
             {
-                interpret(mem, mem.statements[index]);
+                if(index >= mem.statements.size())
+                    continue;
+                ExecResult result = interpret(mem, mem.statements[index]);
+                if(result.status != ExecStatus_Normal)
+                    return result;
             }
-            mem.currentBlockIndex = b.parentBlockIndex;
         }
             break;
         case StatementType_Print:
         {
             const Expr& expr = mem.expressions[statement.expressionIndex];
-            printf("%s\n", stringify(mem, evaluate(mem, expr)).data());
+            printValue(mem, evaluate(mem, expr));
         }
         break;
         case StatementType_VarDeclare:
         {
             const Expr& expr = mem.expressions[statement.expressionIndex];
             ExprValue value = evaluate(mem, expr);
-            defineVariable(mem, mem.strings[mem.tokens[statement.tokenIndex].value.stringIndex], value);
+            defineVariable(mem, statement.varDepth, statement.varSlot, value);
         }
         break;
         case StatementType_If:
@@ -330,12 +290,12 @@ void interpret(MyMemory& mem, const Statement& statement)
             if(isTruthy(mem, evaluate(mem, expr)))
             {
                 const Statement& statementIf = mem.statements[statement.ifStatementIndex];
-                interpret(mem, statementIf);
+                return interpret(mem, statementIf);
             }
             else if(statement.elseStatementIndex >= 0 && statement.elseStatementIndex < mem.statements.size())
             {
                 const Statement& statementElse = mem.statements[statement.elseStatementIndex];
-                interpret(mem, statementElse);
+                return interpret(mem, statementElse);
             }
         }
         break;
@@ -344,7 +304,11 @@ void interpret(MyMemory& mem, const Statement& statement)
             while(isTruthy(mem, evaluate(mem, mem.expressions[statement.expressionIndex])))
             {
                 const Statement& statementWhile = mem.statements[statement.whileStatementIndex];
-                interpret(mem, statementWhile);
+                ExecResult result = interpret(mem, statementWhile);
+                if(result.status == ExecStatus_Break)
+                    break;
+                if(result.status == ExecStatus_Return)
+                    return result;
             }
         }
         break;
@@ -355,21 +319,14 @@ void interpret(MyMemory& mem, const Statement& statement)
         break;
         case StatementType_Return:
         {
-            u32 blockIndex = mem.currentBlockIndex;
-            assert(blockIndex != 0);
-            while(mem.blocks[blockIndex].parentBlockIndex != 0)
-                blockIndex = mem.blocks[blockIndex].parentBlockIndex;
+            assert(mem.callStack.frameCount > 1);
 
-            if(statement.expressionIndex == ~0u)
+            ExprValue value{};
+            if(statement.expressionIndex != ~0u)
             {
-                mem.blocks[blockIndex].variables.insert({"returnValue", ExprValue{}});
-
-            }
-            else
-            {
-                const ExprValue& value = evaluate(mem, statement.expressionIndex);
-                mem.blocks[blockIndex].variables.insert({"returnValue", value});
+                value = evaluate(mem, statement.expressionIndex);
             }
+            return ExecResult{.value = value, .status = ExecStatus_Return };
         }
         break;
         case StatementType_Count:
@@ -380,11 +337,25 @@ void interpret(MyMemory& mem, const Statement& statement)
         break;
 
     }
+    return ExecResult{.status = ExecStatus_Normal };
+}
+
+void interpreter_run(MyMemory& mem)
+{
+    callStack_init(mem.callStack, mem.scriptLocalCount);
+    // Running code holds references into the node pools.
+    ast_reserveLazyBodies(mem);
+
+    for(u32 index : mem.blocks[0].statementIndices)
+    {
+        if(index < mem.statements.size())
+            interpret(mem, mem.statements[index]);
+    }
 }
 
 void interpret(MyMemory& mem, const Expr& expr)
 {
     ExprValue value = evaluate(mem, expr);
-    printf("%s\n", stringify(mem, value).data());
+    printValue(mem, value);
 
 }
\ No newline at end of file
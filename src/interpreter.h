@@ -2,4 +2,20 @@
 
 #include "mymemory.h"
 
-void interpret(MyMemory& mem, const Statement& statement);
+enum ExecStatus : u8
+{
+    ExecStatus_Normal,
+    ExecStatus_Return,
+    // Reserved for loop control, nothing produces these yet.
+    ExecStatus_Break,
+    ExecStatus_Continue,
+};
+
+struct ExecResult
+{
+    ExprValue value;
+    ExecStatus status;
+};
+
+ExecResult interpret(MyMemory& mem, const Statement& statement);
+void interpreter_run(MyMemory& mem);
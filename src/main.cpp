@@ -1,19 +1,54 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <chrono>
+#include <string>
 #include <vector>
 
 #include "astparser.h"
+#include "compiler.h"
 #include "errors.h"
 #include "interpreter.h"
 #include "mymemory.h"
 #include "mytypes.h"
+#include "optimizer.h"
+#include "programcache.h"
+#include "resolver.h"
 #include "scanner.h"
+#include "sourcefile.h"
 #include "statement.h"
+#include "stringheap.h"
 #include "token.h"
+#include "typeinfer.h"
+#include "vm.h"
+
+struct RunOptions
+{
+    // Run the tree-walking interpreter instead of the bytecode vm.
+    bool useAst;
+    bool printCode;
+    // Dump the statements after the optimizer ran.
+    bool printAst;
+    // 0 runs the parsed tree as is, 1 runs optimizer_run() and typeInfer_run() on it.
+    u32 optLevel;
+    // Parse function bodies on their first call, see ast_parseFunction().
+    bool lazyBodies;
+    // Load and store the parsed program in <script>.O<level>.carpc, see programcache.h
+    bool useCache;
+    // Time the scanner alone, sequential against scanThreads.
+    bool benchScan;
+    // Time the vm with the switch and the threaded dispatch loop.
+    bool benchDispatch;
+    // Read statements from stdin after running the script, see runPrompt().
+    bool repl;
+    // Live string bytes a script may reach, 0 for no limit. See stringheap.h
+    u64 stringHeapLimit;
+    bool gcStats;
+    u32 scanThreads;
+};
 
 
-static bool runFile(const char* filename)
+static bool runFile(const char* filename, const RunOptions& options)
 {
     printf("Filename: %s\n", filename);
 
@@ -23,68 +58,389 @@ static bool runFile(const char* filename)
         return false;
     }
 
-    FILE* file = fopen(filename, "rb");
-    if(file == nullptr)
+    MyMemory mem{};
+    mem.optLevel = options.optLevel;
+    mem.stringHeap.limit = options.stringHeapLimit;
+    // "-" streams stdin, the parser starts before the script has fully arrived.
+    if(strcmp(filename, "-") == 0)
+    {
+        sourceFile_openStream(mem.source, stdin);
+    }
+    else if(!sourceFile_open(mem.source, filename))
     {
-        LOG_ERROR("Failed to open file.");
         return false;
     }
-    MyMemory mem{};
 
-    fseek(file, 0L, SEEK_END);
-    size_t sz = ftell(file);
-    fseek(file, 0L, SEEK_SET);
+    // Streamed scripts are not known up front, they are never cached.
+    bool cacheable = options.useCache && strcmp(filename, "-") != 0;
+    std::string cachePath = cacheable ? programCache_path(filename, options.optLevel, options.lazyBodies) : std::string();
+    if(!cacheable || !programCache_load(mem, cachePath.c_str(), options.optLevel, options.lazyBodies))
+    {
+        // The parser pulls tokens from the scanner as it goes.
+        if(!ast_generate(mem, options.scanThreads, options.lazyBodies))
+        {
+            printf("Some failure in: %s\n", filename);
+            sourceFile_close(mem.source);
+            return true;
+        }
+        if(options.optLevel > 0)
+        {
+            u32 rewritten = optimizer_run(mem, 0);
+            if(options.printAst)
+            {
+                printf("Optimizer rewrote %u expressions\n", rewritten);
+            }
+        }
+        // A failed write only costs the next run a parse.
+        if(cacheable)
+        {
+            programCache_save(mem, cachePath.c_str(), options.optLevel, options.lazyBodies);
+        }
+    }
+    if(options.printAst)
+    {
+        ast_print(mem);
+    }
 
-    mem.scriptFileData.resize(sz + 1);
-    fread(mem.scriptFileData.data(), 1, sz, file);
-    mem.scriptFileData[sz] = '\0';
-    fclose(file);
+    bool resolved = resolver_run(mem);
+    if(resolved && options.optLevel > 0)
+    {
+        TypeInferStats stats = typeInfer_run(mem);
+        u32 simplified = optimizer_simplifyIdentities(mem);
+        if(options.printAst)
+        {
+            printf("Type inference proved %u of %u binary ops (%.1f%%)\n", stats.provenBinaryOps, stats.binaryOps,
+                stats.binaryOps > 0 ? 100.0 * stats.provenBinaryOps / stats.binaryOps : 100.0);
+            printf("Optimizer dropped %u int identities\n", simplified);
+        }
+    }
 
-    if(!scanner_run(mem, false))
+    if(!resolved)
     {
         printf("Some failure in: %s\n", filename);
     }
+    else if(options.useAst)
+    {
+        interpreter_run(mem);
+    }
+    else if(bytecode_compile(mem, options.printCode))
+    {
+        vm_run(mem);
+    }
+    if(options.gcStats)
+    {
+        stringHeap_printStats(mem);
+    }
+    sourceFile_close(mem.source);
+
+    return true;
+}
+
+
+
+static double scanOnce(MyMemory& mem, u32 scanThreads, u32& outTokenCount)
+{
+    mem.tokens = TokenStore{};
+    mem.symbols = Interner{};
+    auto start = std::chrono::steady_clock::now();
+    Scanner scanner = scanner_begin(mem);
+    if(scanThreads > 1 && scanner_prescan(scanner, scanThreads))
+    {
+        outTokenCount = (u32)scanner.prescanned.size();
+    }
     else
     {
-        // printf("%s\n", mem.scriptFileData.data());
-        if(ast_generate(mem))
+        Token token;
+        do
         {
-            for(i32 index : mem.blocks[0].statementIndices)
-            {
-                const Statement& statement = mem.statements[index];
-                interpret(mem, statement);
-            }
+            scanner_next(scanner, token);
+        } while(token.type != TokenType::END_OF_FILE);
+        outTokenCount = tokens_count(mem.tokens);
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static bool benchScan(const char* filename, u32 scanThreads)
+{
+    static constexpr u32 Rounds = 5;
+    MyMemory mem{};
+    if(!sourceFile_open(mem.source, filename))
+    {
+        return false;
+    }
+    u32 threadCounts[] = { 1, scanThreads };
+    for(u32 threads : threadCounts)
+    {
+        double best = 0.0;
+        u32 tokenCount = 0;
+        for(u32 round = 0; round < Rounds; ++round)
+        {
+            double ms = scanOnce(mem, threads, tokenCount);
+            best = round == 0 || ms < best ? ms : best;
+        }
+        printf("scan threads: %u, best of %u: %.2f ms, %.1f MB/s, %u tokens\n",
+            threads, Rounds, best, mem.source.size / (best * 1000.0), tokenCount);
+        if(scanThreads <= 1)
+        {
+            break;
         }
     }
+    sourceFile_close(mem.source);
+    return true;
+}
 
+// The script runs Rounds times per loop, it should print little.
+static bool benchDispatch(const char* filename, const RunOptions& options)
+{
+    static constexpr u32 Rounds = 5;
+    MyMemory mem{};
+    mem.optLevel = options.optLevel;
+    if(!sourceFile_open(mem.source, filename))
+    {
+        return false;
+    }
+    bool compiled = ast_generate(mem, options.scanThreads, false);
+    if(compiled && options.optLevel > 0)
+    {
+        optimizer_run(mem, 0);
+    }
+    compiled = compiled && resolver_run(mem);
+    if(compiled && options.optLevel > 0)
+    {
+        typeInfer_run(mem);
+        optimizer_simplifyIdentities(mem);
+    }
+    compiled = compiled && bytecode_compile(mem, false);
+    if(!compiled)
+    {
+        sourceFile_close(mem.source);
+        return false;
+    }
 
+    VmDispatch dispatches[] = { VmDispatch_Switch, VmDispatch_Default };
+    const char* names[] = { "switch", vm_threadedDispatch() ? "threaded" : "switch (default)" };
+    double bests[2] = {};
+    for(u32 i = 0; i < 2; ++i)
+    {
+        for(u32 round = 0; round < Rounds; ++round)
+        {
+            auto start = std::chrono::steady_clock::now();
+            vm_runWith(mem, dispatches[i]);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            bests[i] = round == 0 || elapsed.count() < bests[i] ? elapsed.count() : bests[i];
+        }
+    }
+    for(u32 i = 0; i < 2; ++i)
+    {
+        printf("dispatch: %s, best of %u: %.2f ms\n", names[i], Rounds, bests[i]);
+    }
+    if(vm_threadedDispatch())
+    {
+        printf("threaded dispatch: %.1f%% faster than switch\n", (bests[0] / bests[1] - 1.0) * 100.0);
+    }
+    sourceFile_close(mem.source);
     return true;
 }
 
+// Parses, resolves, compiles and runs source appended to mem.source at offset.
+// Only the new part of the program goes through each step.
+static bool runInput(MyMemory& mem, u32 offset, i32 line, bool echoExpressions)
+{
+    u32 firstExpr = mem.expressions.size();
+    u32 firstFunction = mem.functions.size();
+    u32 firstStatement = mem.blocks.empty() ? 0 : mem.blocks[0].statementIndices.size();
+    if(!ast_generateMore(mem, offset, line))
+    {
+        return false;
+    }
+    if(mem.optLevel > 0)
+    {
+        optimizer_run(mem, firstExpr);
+    }
+    std::vector<u32> statementIndices(mem.blocks[0].statementIndices.begin() + firstStatement,
+        mem.blocks[0].statementIndices.end());
+    if(!resolver_resolveMore(mem, firstFunction, statementIndices))
+    {
+        // Nothing of the input runs later on, its functions were never bound.
+        mem.blocks[0].statementIndices.resize(firstStatement);
+        mem.functions.resize(firstFunction);
+        return false;
+    }
+    u32 entry = bytecode_compileMore(mem, statementIndices, echoExpressions);
+    return entry != ~0u && vm_runFrom(mem, entry);
+}
+
+static void appendSource(MyMemory& mem, const u8* data, u32 size)
+{
+    mem.source.owned.insert(mem.source.owned.end(), data, data + size);
+    mem.source.data = mem.source.owned.data();
+    mem.source.size = mem.source.owned.size();
+}
 
+static i32 countLines(const u8* data, u32 size)
+{
+    i32 lines = 0;
+    for(u32 i = 0; i < size; ++i)
+    {
+        lines += data[i] == '\n';
+    }
+    return lines;
+}
 
-static void runPrompt()
+// One MyMemory lives for the whole session, each input only appends to it.
+// The optional script runs first, its globals and functions stay available.
+static bool runPrompt(const char* filename, const RunOptions& options)
 {
+    MyMemory mem{};
+    mem.optLevel = options.optLevel;
+    mem.stringHeap.limit = options.stringHeapLimit;
+    mem.source.complete = true;
+    i32 line = 1;
+    if(filename != nullptr)
+    {
+        SourceFile script{};
+        if(!sourceFile_open(script, filename))
+        {
+            return false;
+        }
+        appendSource(mem, script.data, script.size);
+        appendSource(mem, (const u8*)"\n", 1);
+        sourceFile_close(script);
+        line += countLines(mem.source.data, mem.source.size);
+        runInput(mem, 0, 1, false);
+    }
+
+    std::string input;
+    char buffer[1024];
+    for(;;)
+    {
+        printf("> ");
+        fflush(stdout);
+        input.clear();
+        while(fgets(buffer, sizeof(buffer), stdin) != nullptr)
+        {
+            input += buffer;
+            if(input.back() == '\n')
+            {
+                break;
+            }
+        }
+        if(input.empty())
+        {
+            break;
+        }
+        u32 offset = mem.source.size;
+        appendSource(mem, (const u8*)input.data(), input.size());
+        runInput(mem, offset, line, true);
+        line += countLines((const u8*)input.data(), input.size());
+    }
+    printf("\n");
+    if(options.gcStats)
+    {
+        stringHeap_printStats(mem);
+    }
+    sourceFile_close(mem.source);
+    return true;
 }
 
 int main(int argc, const char** argv)
 {
-    if(argc > 3)
+    RunOptions options{ .optLevel = 1 };
+    const char* filename = nullptr;
+    for(i32 i = 1; i < argc; ++i)
     {
-        printf("Usage: carp [script]\n");
-        return 64;
+        if(strcmp(argv[i], "--ast") == 0)
+        {
+            options.useAst = true;
+        }
+        else if(strcmp(argv[i], "--print-code") == 0)
+        {
+            options.printCode = true;
+        }
+        else if(strcmp(argv[i], "--print-ast") == 0)
+        {
+            options.printAst = true;
+        }
+        else if(strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0)
+        {
+            options.optLevel = (u32)(argv[i][2] - '0');
+        }
+        else if(strcmp(argv[i], "--lazy") == 0)
+        {
+            options.lazyBodies = true;
+        }
+        else if(strcmp(argv[i], "--cache") == 0)
+        {
+            options.useCache = true;
+        }
+        else if(strcmp(argv[i], "--repl") == 0)
+        {
+            options.repl = true;
+        }
+        else if(strcmp(argv[i], "--bench-scan") == 0)
+        {
+            options.benchScan = true;
+        }
+        else if(strcmp(argv[i], "--bench-dispatch") == 0)
+        {
+            options.benchDispatch = true;
+        }
+        else if(strcmp(argv[i], "--string-heap-limit") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+        {
+            options.stringHeapLimit = (u64)atoi(argv[++i]) << 20;
+        }
+        else if(strcmp(argv[i], "--gc-stats") == 0)
+        {
+            options.gcStats = true;
+        }
+        else if(strcmp(argv[i], "--scan-threads") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+        {
+            options.scanThreads = (u32)atoi(argv[++i]);
+        }
+        else if(filename == nullptr && (argv[i][0] != '-' || strcmp(argv[i], "-") == 0))
+        {
+            filename = argv[i];
+        }
+        else
+        {
+            printf("Usage: carp [--ast] [--print-code] [--print-ast] [-O0 | -O1] [--lazy] [--cache] [--repl] [--string-heap-limit MB] [--gc-stats] [--scan-threads N] [--bench-scan] [--bench-dispatch] [script | -]\n");
+            return 64;
+        }
+    }
+
+    if(options.repl)
+    {
+        if(!runPrompt(filename, options))
+        {
+            printf("Failed to run file: %s\n", filename);
+        }
     }
-    else if(argc == 2)
+    else if(options.benchDispatch)
     {
-        if(!runFile(argv[1]))
+        if(filename == nullptr || !benchDispatch(filename, options))
         {
-            printf("Failed to run file: %s\n", argv[1]);
+            printf("Failed to bench file: %s\n", filename != nullptr ? filename : "");
+        }
+    }
+    else if(options.benchScan)
+    {
+        if(filename == nullptr || !benchScan(filename, options.scanThreads))
+        {
+            printf("Failed to bench file: %s\n", filename != nullptr ? filename : "");
+        }
+    }
+    else if(filename != nullptr)
+    {
+        if(!runFile(filename, options))
+        {
+            printf("Failed to run file: %s\n", filename);
         }
     }
     else
     {
-        const char* filename = "progs/print.carp";
-        if(!runFile(filename))
+        filename = "progs/print.carp";
+        if(!runFile(filename, options))
         {
             printf("Failed to run file: %s\n", filename);
         }
@@ -4,11 +4,16 @@
 #include <vector>
 
 #include "block.h"
+#include "callstack.h"
 #include "expr.h"
+#include "interner.h"
 #include "mytypes.h"
 #include "scanner.h"
+#include "sourcefile.h"
 #include "statement.h"
+#include "stringheap.h"
 #include "token.h"
+#include "value.h"
 
 struct MyMemory
 {
@@ -16,9 +21,32 @@ struct MyMemory
     i32 statementIndex;
     std::vector<Block> blocks;
     std::vector<std::string> strings;
-    std::vector<Token> tokens;
+    StringHeap stringHeap;
+    Interner symbols;
+    TokenStore tokens;
     std::vector<Expr> expressions;
+    // Side tables of the compact Expr and Statement nodes.
+    std::vector<ExprValue> literals;
+    std::vector<u32> callArgs;
+    std::vector<u32> paramNames;
     std::vector<Statement> statements;
-    std::vector<u8> scriptFileData;
+    SourceFile source;
     std::vector<Statement> functions;
+    // Applied to function bodies parsed on their first call, see ast_parseFunction().
+    u32 optLevel;
+
+    // Resolved variable storage, see resolver.h
+    std::vector<ExprValue> globals;
+    std::vector<u32> globalNames;
+    CallStack callStack;
+    u32 scriptLocalCount;
+    // StaticType set per expression, see typeinfer.h
+    std::vector<u8> exprTypes;
+
+    // Bytecode, see compiler.h
+    std::vector<u8> code;
+    std::vector<i32> codeLines;
+    std::vector<Value> constants;
+    BoxedInts boxedInts;
+    std::vector<u32> functionEntries;
 };
@@ -1,6 +1,5 @@
 #pragma once
 
-#include <ctype.h> // isalnum
 #include <stdint.h>
 
 
@@ -19,9 +18,59 @@ using f64 = double;
 
 
 
+enum CharClass : u8
+{
+    CharClass_Digit = 1,
+    CharClass_Alpha = CharClass_Digit << 1,
+    CharClass_Underscore = CharClass_Alpha << 1,
+    CharClass_HexDigit = CharClass_Underscore << 1,
+};
+
+struct CharClassTable
+{
+    u8 classes[256];
+};
+
+// ASCII only and locale independent, unlike isalnum / isdigit.
+static consteval CharClassTable makeCharClassTable()
+{
+    CharClassTable table{};
+    for(u32 c = '0'; c <= '9'; ++c)
+        table.classes[c] |= CharClass_Digit;
+    for(u32 c = 'a'; c <= 'z'; ++c)
+        table.classes[c] |= CharClass_Alpha;
+    for(u32 c = 'A'; c <= 'Z'; ++c)
+        table.classes[c] |= CharClass_Alpha;
+    table.classes['_'] |= CharClass_Underscore;
+    for(u32 c = '0'; c <= '9'; ++c)
+        table.classes[c] |= CharClass_HexDigit;
+    for(u32 c = 'a'; c <= 'f'; ++c)
+        table.classes[c] |= CharClass_HexDigit;
+    for(u32 c = 'A'; c <= 'F'; ++c)
+        table.classes[c] |= CharClass_HexDigit;
+    return table;
+}
+
+static constexpr CharClassTable charClassTable = makeCharClassTable();
+
+static bool isDigit(char c)
+{
+    return (charClassTable.classes[(u8)c] & CharClass_Digit) != 0;
+}
+
+static bool isHexDigit(char c)
+{
+    return (charClassTable.classes[(u8)c] & CharClass_HexDigit) != 0;
+}
+
+static bool isAlpha(char c)
+{
+    return (charClassTable.classes[(u8)c] & CharClass_Alpha) != 0;
+}
+
 static bool isAlphaNumUnderscore(char c)
 {
-    return isalnum(c) || c == '_';
+    return (charClassTable.classes[(u8)c] & (CharClass_Digit | CharClass_Alpha | CharClass_Underscore)) != 0;
 }
 
 #if _MSC_VER
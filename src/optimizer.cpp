@@ -0,0 +1,247 @@
+#include "optimizer.h"
+
+#include <limits>
+
+#include "expr.h"
+#include "helpers.h"
+#include "mymemory.h"
+#include "token.h"
+#include "typeinfer.h"
+
+static constexpr i64 I64Min = std::numeric_limits<i64>::min();
+static constexpr i64 I64Max = std::numeric_limits<i64>::max();
+static constexpr i64 NegFull = ~i64(0);
+
+static bool isLiteral(const Expr& expr)
+{
+    return expr.exprType == ExprType_Literal;
+}
+
+static bool isIntLiteral(const MyMemory& mem, const Expr& expr, i64 value)
+{
+    if(!isLiteral(expr))
+    {
+        return false;
+    }
+    const ExprValue& literal = mem.literals[expr.literalIndex];
+    return literal.literalType == LiteralType_I64 && literal.value == value;
+}
+
+// Overflow and division by zero stay for the runtime, folding them would
+// change what the script does.
+static bool intOperFolds(TokenType type, i64 a, i64 b)
+{
+    switch(type)
+    {
+        case TokenType::PLUS:
+            return b >= 0 ? a <= I64Max - b : a >= I64Min - b;
+        case TokenType::MINUS:
+            return b >= 0 ? a >= I64Min + b : a <= I64Max + b;
+        case TokenType::STAR:
+        {
+            if(a == 0 || b == 0)
+            {
+                return true;
+            }
+            if((a == -1 && b == I64Min) || (b == -1 && a == I64Min))
+            {
+                return false;
+            }
+            i64 product = (i64)((u64)a * (u64)b);
+            return product / b == a;
+        }
+        case TokenType::SLASH:
+            return b != 0 && !(a == I64Min && b == -1);
+        default:
+            return true;
+    }
+}
+
+static void setLiteral(Expr& expr, u32 literalIndex)
+{
+    expr = Expr{ .tokenOperIndex = expr.tokenOperIndex, .literalIndex = literalIndex, .exprType = ExprType_Literal };
+}
+
+// Same rules as evaluate() and the vm binary ops.
+static bool foldBinary(MyMemory& mem, Expr& expr)
+{
+    if(!isLiteral(mem.expressions[expr.leftExprIndex]) || !isLiteral(mem.expressions[expr.rightExprIndex]))
+    {
+        return false;
+    }
+    const ExprValue left = mem.literals[mem.expressions[expr.leftExprIndex].literalIndex];
+    const ExprValue right = mem.literals[mem.expressions[expr.rightExprIndex].literalIndex];
+    TokenType operType = getTokenOperType(mem, expr);
+    ExprValue value{};
+    if(checkNumber(left) && checkNumber(right))
+    {
+        if(left.literalType == LiteralType_Double || right.literalType == LiteralType_Double)
+        {
+            value = doDoubleOperOnBinary(operType, getDouble(left), getDouble(right));
+        }
+        else if(intOperFolds(operType, left.value, right.value))
+        {
+            value = doIntOperOnBinary(operType, left.value, right.value);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else if(checkString(left) && checkString(right) && operType == TokenType::PLUS)
+    {
+        std::string s = mem.strings[left.stringIndex];
+        s += mem.strings[right.stringIndex];
+        value = ExprValue{ .stringIndex = addString(mem, s), .literalType = LiteralType_String };
+    }
+    else if(checkString(left) && checkString(right))
+    {
+        value = doStringOperOnBinary(mem, operType, left.stringIndex, right.stringIndex);
+    }
+    else
+    {
+        return false;
+    }
+
+    if(value.literalType == LiteralType_None)
+    {
+        return false;
+    }
+    setLiteral(expr, addLiteral(mem, value));
+    return true;
+}
+
+static bool foldUnary(MyMemory& mem, Expr& expr)
+{
+    const Expr& right = mem.expressions[expr.rightExprIndex];
+    if(!isLiteral(right))
+    {
+        return false;
+    }
+    ExprValue value = mem.literals[right.literalIndex];
+    switch(getTokenOperType(mem, expr))
+    {
+        case TokenType::MINUS:
+            if(value.literalType == LiteralType_Double)
+            {
+                value.doubleValue = -value.doubleValue;
+            }
+            else if(value.literalType == LiteralType_I64 && value.value != I64Min)
+            {
+                value.value = -value.value;
+            }
+            else
+            {
+                return false;
+            }
+            break;
+        case TokenType::BANG:
+            value = ExprValue{ .value = isTruthy(mem, value) ? 0 : NegFull, .literalType = LiteralType_Boolean };
+            break;
+        default:
+            return false;
+    }
+    setLiteral(expr, addLiteral(mem, value));
+    return true;
+}
+
+// A literal left side decides the branch, the node becomes whichever side
+// evaluate() would have returned.
+static bool foldLogical(MyMemory& mem, Expr& expr)
+{
+    const Expr& left = mem.expressions[expr.leftExprIndex];
+    if(!isLiteral(left))
+    {
+        return false;
+    }
+    TokenType operType = getTokenOperType(mem, expr);
+    bool leftTruthy = isTruthy(mem, mem.literals[left.literalIndex]);
+    if((operType == TokenType::OR && leftTruthy) || (operType == TokenType::AND && !leftTruthy))
+    {
+        setLiteral(expr, left.literalIndex);
+    }
+    else
+    {
+        expr = mem.expressions[expr.rightExprIndex];
+    }
+    return true;
+}
+
+// x + 0, 0 + x, x - 0, x * 1, 1 * x and x / 1 for x proven to be an int.
+// Doubles are left alone, -0.0 + 0 is not -0.0.
+static bool simplifyIntIdentity(MyMemory& mem, u32 exprIndex)
+{
+    Expr& expr = mem.expressions[exprIndex];
+    const Expr& left = mem.expressions[expr.leftExprIndex];
+    const Expr& right = mem.expressions[expr.rightExprIndex];
+    bool leftInt = typeInfer_exprType(mem, expr.leftExprIndex) == StaticType_Int;
+    bool rightInt = typeInfer_exprType(mem, expr.rightExprIndex) == StaticType_Int;
+    u32 keepIndex = ~0u;
+    switch(getTokenOperType(mem, expr))
+    {
+        case TokenType::PLUS:
+            keepIndex = leftInt && isIntLiteral(mem, right, 0) ? expr.leftExprIndex
+                : rightInt && isIntLiteral(mem, left, 0) ? expr.rightExprIndex : ~0u;
+            break;
+        case TokenType::MINUS:
+            keepIndex = leftInt && isIntLiteral(mem, right, 0) ? expr.leftExprIndex : ~0u;
+            break;
+        case TokenType::STAR:
+            keepIndex = leftInt && isIntLiteral(mem, right, 1) ? expr.leftExprIndex
+                : rightInt && isIntLiteral(mem, left, 1) ? expr.rightExprIndex : ~0u;
+            break;
+        case TokenType::SLASH:
+            keepIndex = leftInt && isIntLiteral(mem, right, 1) ? expr.leftExprIndex : ~0u;
+            break;
+        default:
+            break;
+    }
+    if(keepIndex == ~0u)
+    {
+        return false;
+    }
+    expr = mem.expressions[keepIndex];
+    mem.exprTypes[exprIndex] = mem.exprTypes[keepIndex];
+    return true;
+}
+
+u32 optimizer_run(MyMemory& mem, u32 firstExpr)
+{
+    // The parser adds children before their parent, one pass in index order
+    // sees every subtree already folded.
+    u32 rewritten = 0;
+    for(u32 i = firstExpr; i < mem.expressions.size(); ++i)
+    {
+        Expr& expr = mem.expressions[i];
+        bool changed = false;
+        switch(expr.exprType)
+        {
+            case ExprType_Binary:
+                changed = foldBinary(mem, expr);
+                break;
+            case ExprType_Unary:
+                changed = foldUnary(mem, expr);
+                break;
+            case ExprType_Logical:
+                changed = foldLogical(mem, expr);
+                break;
+            default:
+                break;
+        }
+        rewritten += changed ? 1 : 0;
+    }
+    return rewritten;
+}
+
+u32 optimizer_simplifyIdentities(MyMemory& mem)
+{
+    u32 rewritten = 0;
+    for(u32 i = 0; i < mem.expressions.size() && i < mem.exprTypes.size(); ++i)
+    {
+        if(mem.expressions[i].exprType == ExprType_Binary && simplifyIntIdentity(mem, i))
+        {
+            rewritten++;
+        }
+    }
+    return rewritten;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "mytypes.h"
+
+struct MyMemory;
+
+// Rewrites mem.expressions in place after parsing, before the resolver runs.
+// Folds literal subtrees. Starts at firstExpr, the nodes before it are left
+// as they are. Returns how many expressions were rewritten.
+u32 optimizer_run(MyMemory& mem, u32 firstExpr);
+// Runs after typeInfer_run(), drops int identities like x * 1 and x + 0 where
+// x is proven to be an int. Returns how many expressions were rewritten.
+u32 optimizer_simplifyIdentities(MyMemory& mem);
@@ -0,0 +1,337 @@
+#include "programcache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <type_traits>
+#include <vector>
+
+#include "mymemory.h"
+#include "sourcefile.h"
+
+// Bump whenever the meaning of a cached table changes.
+static constexpr u32 ProgramCache_Version = 5;
+static constexpr char ProgramCache_Magic[8] = { 'C', 'A', 'R', 'P', 'C', '\0', '\0', '\0' };
+static constexpr u32 EndianMark = 0x01020304;
+
+struct CacheHeader
+{
+    char magic[8];
+    u32 version;
+    u32 endianMark;
+    // Node layouts of the build that wrote the cache.
+    u32 exprSize;
+    u32 statementSize;
+    u32 valueSize;
+    u32 optLevel;
+    // Lazy parses leave bodies unparsed, blockIndex -1.
+    u32 lazyBodies;
+    // Headers are compared with memcmp(), no padding may be left uninitialized.
+    u32 reserved;
+    u64 sourceHash;
+    u64 sourceSize;
+    // Of every byte after the header. The tables are used without checking
+    // their indices, a damaged cache has to be a miss.
+    u64 payloadHash;
+};
+static_assert(sizeof(CacheHeader) == 64);
+
+static constexpr u64 FnvOffset = 14695981039346656037ull;
+
+struct CacheWriter
+{
+    FILE* file;
+    u64 payloadHash;
+    bool ok;
+};
+
+struct CacheReader
+{
+    const u8* pos;
+    const u8* end;
+    bool ok;
+};
+
+// FNV-1a, 64 bit, continues from hash so a stream can be hashed in parts.
+static u64 hashBytes(u64 hash, const u8* data, u64 size)
+{
+    for(u64 i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static CacheHeader makeHeader(const MyMemory& mem, u32 optLevel, bool lazyBodies)
+{
+    CacheHeader header{
+        .version = ProgramCache_Version,
+        .endianMark = EndianMark,
+        .exprSize = sizeof(Expr),
+        .statementSize = sizeof(Statement),
+        .valueSize = sizeof(ExprValue),
+        .optLevel = optLevel,
+        .lazyBodies = lazyBodies ? 1u : 0u,
+        .sourceHash = hashBytes(FnvOffset, mem.source.data, mem.source.size),
+        .sourceSize = mem.source.size
+    };
+    memcpy(header.magic, ProgramCache_Magic, sizeof(header.magic));
+    return header;
+}
+
+static void writeBytes(CacheWriter& writer, const void* data, u64 size)
+{
+    if(size > 0 && fwrite(data, 1, size, writer.file) != size)
+    {
+        writer.ok = false;
+    }
+    writer.payloadHash = hashBytes(writer.payloadHash, (const u8*)data, size);
+}
+
+// Tables are written as a u64 count followed by the raw elements.
+template <typename T>
+static void writeArray(CacheWriter& writer, const std::vector<T>& values)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    u64 count = values.size();
+    writeBytes(writer, &count, sizeof(count));
+    writeBytes(writer, values.data(), count * sizeof(T));
+}
+
+static void readBytes(CacheReader& reader, void* out, u64 size)
+{
+    if(!reader.ok || (u64)(reader.end - reader.pos) < size)
+    {
+        reader.ok = false;
+        return;
+    }
+    if(size > 0)
+    {
+        memcpy(out, reader.pos, size);
+    }
+    reader.pos += size;
+}
+
+// One copy per table, the elements are used as they were written.
+template <typename T>
+static void readArray(CacheReader& reader, std::vector<T>& out)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    u64 count = 0;
+    readBytes(reader, &count, sizeof(count));
+    if(!reader.ok || count > (u64)(reader.end - reader.pos) / sizeof(T))
+    {
+        reader.ok = false;
+        return;
+    }
+    out.resize(count);
+    readBytes(reader, out.data(), count * sizeof(T));
+}
+
+static void writeStrings(CacheWriter& writer, const std::vector<std::string>& strings)
+{
+    std::vector<u32> starts;
+    std::vector<char> chars;
+    starts.reserve(strings.size() + 1);
+    for(const std::string& s : strings)
+    {
+        starts.push_back(chars.size());
+        chars.insert(chars.end(), s.begin(), s.end());
+    }
+    starts.push_back(chars.size());
+    writeArray(writer, starts);
+    writeArray(writer, chars);
+}
+
+static void readStrings(CacheReader& reader, std::vector<std::string>& strings)
+{
+    std::vector<u32> starts;
+    std::vector<char> chars;
+    readArray(reader, starts);
+    readArray(reader, chars);
+    if(!reader.ok || starts.empty())
+    {
+        reader.ok = false;
+        return;
+    }
+    strings.resize(starts.size() - 1);
+    for(u32 i = 0; i + 1 < starts.size(); ++i)
+    {
+        if(starts[i] > starts[i + 1] || starts[i + 1] > chars.size())
+        {
+            reader.ok = false;
+            return;
+        }
+        strings[i].assign(chars.data() + starts[i], starts[i + 1] - starts[i]);
+    }
+}
+
+static void writeBlocks(CacheWriter& writer, const std::vector<Block>& blocks)
+{
+    std::vector<i32> parents;
+    std::vector<u32> starts;
+    std::vector<u32> statementIndices;
+    for(const Block& block : blocks)
+    {
+        parents.push_back(block.parentBlockIndex);
+        starts.push_back(statementIndices.size());
+        statementIndices.insert(statementIndices.end(), block.statementIndices.begin(), block.statementIndices.end());
+    }
+    starts.push_back(statementIndices.size());
+    writeArray(writer, parents);
+    writeArray(writer, starts);
+    writeArray(writer, statementIndices);
+}
+
+static void readBlocks(CacheReader& reader, std::vector<Block>& blocks)
+{
+    std::vector<i32> parents;
+    std::vector<u32> starts;
+    std::vector<u32> statementIndices;
+    readArray(reader, parents);
+    readArray(reader, starts);
+    readArray(reader, statementIndices);
+    if(!reader.ok || starts.size() != parents.size() + 1)
+    {
+        reader.ok = false;
+        return;
+    }
+    blocks.resize(parents.size());
+    for(u32 i = 0; i < parents.size(); ++i)
+    {
+        if(starts[i] > starts[i + 1] || starts[i + 1] > statementIndices.size())
+        {
+            reader.ok = false;
+            return;
+        }
+        blocks[i].parentBlockIndex = parents[i];
+        blocks[i].statementIndices.assign(statementIndices.begin() + starts[i], statementIndices.begin() + starts[i + 1]);
+    }
+}
+
+static void clearProgram(MyMemory& mem)
+{
+    mem.symbols = Interner{};
+    mem.tokens = TokenStore{};
+    mem.strings.clear();
+    mem.literals.clear();
+    mem.expressions.clear();
+    mem.callArgs.clear();
+    mem.paramNames.clear();
+    mem.statements.clear();
+    mem.functions.clear();
+    mem.blocks.clear();
+}
+
+std::string programCache_path(const char* scriptPath, u32 optLevel, bool lazyBodies)
+{
+    std::string path = scriptPath;
+    if(path.size() >= 5 && path.compare(path.size() - 5, 5, ".carp") == 0)
+    {
+        path.resize(path.size() - 5);
+    }
+    return path + ".O" + std::to_string(optLevel) + (lazyBodies ? ".lazy" : "") + ".carpc";
+}
+
+bool programCache_load(MyMemory& mem, const char* cachePath, u32 optLevel, bool lazyBodies)
+{
+    // A missing cache is the normal first run, not an error worth logging.
+    FILE* probe = fopen(cachePath, "rb");
+    if(probe == nullptr)
+    {
+        return false;
+    }
+    fclose(probe);
+
+    SourceFile cacheFile{};
+    if(!sourceFile_open(cacheFile, cachePath))
+    {
+        return false;
+    }
+    CacheReader reader{ .pos = cacheFile.data, .end = cacheFile.data + cacheFile.size, .ok = true };
+    CacheHeader header{};
+    readBytes(reader, &header, sizeof(header));
+    CacheHeader expected = makeHeader(mem, optLevel, lazyBodies);
+    expected.payloadHash = hashBytes(FnvOffset, reader.pos, reader.end - reader.pos);
+    if(!reader.ok || memcmp(&header, &expected, sizeof(header)) != 0)
+    {
+        sourceFile_close(cacheFile);
+        return false;
+    }
+
+    readArray(reader, mem.symbols.chars);
+    readArray(reader, mem.symbols.symbols);
+    readArray(reader, mem.symbols.table);
+    readArray(reader, mem.tokens.types);
+    readArray(reader, mem.tokens.lexemes);
+    readArray(reader, mem.tokens.lineRuns);
+    readStrings(reader, mem.strings);
+    stringHeap_reset(mem);
+    readArray(reader, mem.literals);
+    readArray(reader, mem.expressions);
+    readArray(reader, mem.callArgs);
+    readArray(reader, mem.paramNames);
+    readArray(reader, mem.statements);
+    readArray(reader, mem.functions);
+    readBlocks(reader, mem.blocks);
+    bool result = reader.ok && reader.pos == reader.end && !mem.blocks.empty();
+    if(!result)
+    {
+        clearProgram(mem);
+    }
+    sourceFile_close(cacheFile);
+    return result;
+}
+
+bool programCache_save(const MyMemory& mem, const char* cachePath, u32 optLevel, bool lazyBodies)
+{
+    std::string tempPath = std::string(cachePath) + ".tmp"
+        + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if(file == nullptr)
+    {
+        return false;
+    }
+    CacheWriter writer{ .file = file, .ok = true };
+    CacheHeader header = makeHeader(mem, optLevel, lazyBodies);
+    writeBytes(writer, &header, sizeof(header));
+    writer.payloadHash = FnvOffset;
+
+    writeArray(writer, mem.symbols.chars);
+    writeArray(writer, mem.symbols.symbols);
+    writeArray(writer, mem.symbols.table);
+    writeArray(writer, mem.tokens.types);
+    writeArray(writer, mem.tokens.lexemes);
+    writeArray(writer, mem.tokens.lineRuns);
+    writeStrings(writer, mem.strings);
+    writeArray(writer, mem.literals);
+    writeArray(writer, mem.expressions);
+    writeArray(writer, mem.callArgs);
+    writeArray(writer, mem.paramNames);
+    writeArray(writer, mem.statements);
+    writeArray(writer, mem.functions);
+    writeBlocks(writer, mem.blocks);
+
+    // The header goes in again with the hash of what followed it.
+    header.payloadHash = writer.payloadHash;
+    writer.ok &= fseek(file, 0, SEEK_SET) == 0;
+    writeBytes(writer, &header, sizeof(header));
+    writer.ok &= fclose(file) == 0;
+    if(!writer.ok)
+    {
+        remove(tempPath.c_str());
+        return false;
+    }
+#if _WIN32
+    // rename() does not replace an existing file on Windows.
+    remove(cachePath);
+#endif
+    if(rename(tempPath.c_str(), cachePath) != 0)
+    {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
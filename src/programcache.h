@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+#include "mytypes.h"
+
+struct MyMemory;
+
+// Parsed program cache, written next to the script as <script>.O<level>.carpc,
+// <script>.O<level>.lazy.carpc for --lazy, so each mode keeps its own.
+// It holds everything ast_generate() and optimizer_run() leave in MyMemory:
+// tokens, symbols, strings, expressions, statements, blocks and functions.
+// A cache only matches the exact source bytes, optimization level, lazy mode
+// and interpreter build that wrote it, anything else is a miss. So is a cache
+// whose bytes were damaged after writing, see tests/programcache_test.cpp.
+std::string programCache_path(const char* scriptPath, u32 optLevel, bool lazyBodies);
+
+// mem.source must already be open. Returns false on a miss, mem is left
+// untouched then and the script has to be parsed.
+bool programCache_load(MyMemory& mem, const char* cachePath, u32 optLevel, bool lazyBodies);
+// Writes to a temporary file and renames it over cachePath, so concurrent
+// runs of the same script never see a partial cache.
+bool programCache_save(const MyMemory& mem, const char* cachePath, u32 optLevel, bool lazyBodies);
@@ -0,0 +1,356 @@
+#include "resolver.h"
+
+#include "errors.h"
+#include "expr.h"
+#include "helpers.h"
+#include "mymemory.h"
+#include "token.h"
+
+#include <assert.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Resolver
+{
+    MyMemory& mem;
+    // Keyed by symbol index.
+    std::unordered_map<u32, u32> globalSlots;
+    std::vector<std::unordered_map<u32, u32>> scopes;
+    u32 nextSlot;
+    u32 maxSlot;
+    bool inFunction;
+    bool hasErrors;
+};
+
+static void resolveStatement(Resolver& resolver, u32 statementIndex);
+
+static void resolveError(Resolver& resolver, const Token& token, const std::string& message)
+{
+    resolver.hasErrors = true;
+    reportError(resolver.mem, token, message);
+}
+
+// Tokens do not keep values, identifiers were interned by the scanner.
+static u32 nameSymbol(const Resolver& resolver, const Token& name)
+{
+    std::string_view lexeme = getTokenLexeme(resolver.mem, name);
+    u32 symbol = interner_find(resolver.mem.symbols, lexeme.data(), (u32)lexeme.size());
+    assert(symbol != ~0u);
+    return symbol;
+}
+
+static u32 nameSymbol(const Resolver& resolver, u32 nameTokenIndex)
+{
+    std::string_view lexeme = getTokenLexeme(resolver.mem, nameTokenIndex);
+    u32 symbol = interner_find(resolver.mem.symbols, lexeme.data(), (u32)lexeme.size());
+    assert(symbol != ~0u);
+    return symbol;
+}
+
+static u32 addGlobal(Resolver& resolver, const Token& name)
+{
+    u32 symbol = nameSymbol(resolver, name);
+    if(resolver.globalSlots.contains(symbol))
+    {
+        resolveError(resolver, name, "Variable already exists!");
+        return resolver.globalSlots[symbol];
+    }
+    u32 slot = resolver.mem.globals.size();
+    resolver.mem.globals.emplace_back(ExprValue{});
+    resolver.mem.globalNames.push_back(symbol);
+    resolver.globalSlots.insert({symbol, slot});
+    return slot;
+}
+
+static u32 declareLocal(Resolver& resolver, const Token& name)
+{
+    assert(!resolver.scopes.empty());
+    u32 symbol = nameSymbol(resolver, name);
+    std::unordered_map<u32, u32>& scope = resolver.scopes.back();
+    if(scope.contains(symbol))
+    {
+        resolveError(resolver, name, "Variable already exists!");
+        return scope[symbol];
+    }
+    u32 slot = resolver.nextSlot++;
+    resolver.maxSlot = resolver.nextSlot > resolver.maxSlot ? resolver.nextSlot : resolver.maxSlot;
+    scope.insert({symbol, slot});
+    return slot;
+}
+
+static void beginScope(Resolver& resolver)
+{
+    resolver.scopes.emplace_back();
+}
+
+static void endScope(Resolver& resolver)
+{
+    // Slots of the block can be reused by the following siblings.
+    resolver.nextSlot -= resolver.scopes.back().size();
+    resolver.scopes.pop_back();
+}
+
+static void resolveName(Resolver& resolver, Expr& expr)
+{
+    u32 symbol = nameSymbol(resolver, expr.tokenOperIndex);
+    for(i32 i = (i32)resolver.scopes.size() - 1; i >= 0; --i)
+    {
+        auto iter = resolver.scopes[i].find(symbol);
+        if(iter != resolver.scopes[i].end())
+        {
+            expr.varDepth = VarDepth_Local;
+            expr.varSlot = iter->second;
+            return;
+        }
+    }
+    auto iter = resolver.globalSlots.find(symbol);
+    if(iter != resolver.globalSlots.end())
+    {
+        expr.varDepth = VarDepth_Global;
+        expr.varSlot = iter->second;
+        return;
+    }
+    resolveError(resolver, tokens_get(resolver.mem.tokens, expr.tokenOperIndex), "Variable not found!");
+}
+
+static void resolveExpression(Resolver& resolver, u32 exprIndex)
+{
+    assert(exprIndex < resolver.mem.expressions.size());
+    Expr& expr = resolver.mem.expressions[exprIndex];
+    switch(expr.exprType)
+    {
+        case ExprType_None:
+        case ExprType_Literal:
+            break;
+        case ExprType_Binary:
+        case ExprType_Logical:
+        {
+            resolveExpression(resolver, expr.leftExprIndex);
+            resolveExpression(resolver, expr.rightExprIndex);
+        }
+        break;
+        case ExprType_Unary:
+        {
+            resolveExpression(resolver, expr.rightExprIndex);
+        }
+        break;
+        case ExprType_Variable:
+        {
+            resolveName(resolver, expr);
+        }
+        break;
+        case ExprType_Assign:
+        {
+            resolveExpression(resolver, expr.rightExprIndex);
+            resolveName(resolver, expr);
+        }
+        break;
+        case ExprType_CallFn:
+        {
+            resolveExpression(resolver, expr.callee);
+            for(u32 i = 0; i < expr.argCount; ++i)
+            {
+                resolveExpression(resolver, resolver.mem.callArgs[expr.argsStart + i]);
+            }
+        }
+        break;
+    }
+}
+
+static void resolveStatements(Resolver& resolver, const std::vector<u32>& statementIndices)
+{
+    for(u32 index : statementIndices)
+    {
+        // Function declarations live in mem.functions and leave ~0 in the block.
+        if(index < resolver.mem.statements.size())
+        {
+            resolveStatement(resolver, index);
+        }
+    }
+}
+
+static void resolveStatement(Resolver& resolver, u32 statementIndex)
+{
+    Statement& statement = resolver.mem.statements[statementIndex];
+    switch(statement.type)
+    {
+        case StatementType_Expression:
+        case StatementType_Print:
+        {
+            resolveExpression(resolver, statement.expressionIndex);
+        }
+        break;
+        case StatementType_VarDeclare:
+        {
+            // Initializer sees the outer binding, var a = a; is legal.
+            resolveExpression(resolver, statement.expressionIndex);
+            Token name = tokens_get(resolver.mem.tokens, statement.tokenIndex);
+            if(resolver.scopes.empty())
+            {
+                auto iter = resolver.globalSlots.find(nameSymbol(resolver, name));
+                statement.varDepth = VarDepth_Global;
+                statement.varSlot = iter != resolver.globalSlots.end() ? iter->second : addGlobal(resolver, name);
+            }
+            else
+            {
+                statement.varDepth = VarDepth_Local;
+                statement.varSlot = declareLocal(resolver, name);
+            }
+        }
+        break;
+        case StatementType_Block:
+        {
+            beginScope(resolver);
+            resolveStatements(resolver, resolver.mem.blocks[statement.blockIndex].statementIndices);
+            endScope(resolver);
+        }
+        break;
+        case StatementType_If:
+        {
+            resolveExpression(resolver, statement.expressionIndex);
+            resolveStatement(resolver, statement.ifStatementIndex);
+            if(statement.elseStatementIndex < resolver.mem.statements.size())
+            {
+                resolveStatement(resolver, statement.elseStatementIndex);
+            }
+        }
+        break;
+        case StatementType_While:
+        {
+            resolveExpression(resolver, statement.expressionIndex);
+            resolveStatement(resolver, statement.whileStatementIndex);
+        }
+        break;
+        case StatementType_Return:
+        {
+            if(!resolver.inFunction)
+            {
+                resolver.hasErrors = true;
+                reportError(-1, "Cannot return from top-level code!", "in resolver");
+            }
+            if(statement.expressionIndex != ~0u)
+            {
+                resolveExpression(resolver, statement.expressionIndex);
+            }
+        }
+        break;
+        case StatementType_CallFn:
+        case StatementType_Count:
+            break;
+    }
+}
+
+static void resolveFunction(Resolver& resolver, u32 fnIndex)
+{
+    MyMemory& mem = resolver.mem;
+    Statement& function = mem.functions[fnIndex];
+    resolver.nextSlot = 0;
+    resolver.maxSlot = 0;
+    beginScope(resolver);
+    for(u32 i = 0; i < function.paramsCount; ++i)
+    {
+        declareLocal(resolver, tokens_get(mem.tokens, mem.paramNames[function.paramsStart + i]));
+    }
+    resolveStatements(resolver, mem.blocks[function.blockIndex].statementIndices);
+    endScope(resolver);
+    function.localSlotCount = resolver.maxSlot;
+}
+
+bool resolver_run(MyMemory& mem)
+{
+    Resolver resolver{.mem = mem, .nextSlot = 0, .maxSlot = 0, .inFunction = false, .hasErrors = false };
+
+    mem.globals.clear();
+    mem.globalNames.clear();
+
+    // Globals are late bound, functions may refer to vars declared after them.
+    for(u32 fnIndex = 0; fnIndex < mem.functions.size(); ++fnIndex)
+    {
+        u32 slot = addGlobal(resolver, tokens_get(mem.tokens, mem.functions[fnIndex].tokenNameIndex));
+        mem.globals[slot] = ExprValue{.stringIndex = fnIndex, .literalType = LiteralType_Function };
+    }
+    for(u32 index : mem.blocks[0].statementIndices)
+    {
+        if(index < mem.statements.size() && mem.statements[index].type == StatementType_VarDeclare)
+        {
+            addGlobal(resolver, tokens_get(mem.tokens, mem.statements[index].tokenIndex));
+        }
+    }
+
+    resolveStatements(resolver, mem.blocks[0].statementIndices);
+    mem.scriptLocalCount = resolver.maxSlot;
+
+    resolver.inFunction = true;
+    for(u32 fnIndex = 0; fnIndex < mem.functions.size(); ++fnIndex)
+    {
+        if(mem.functions[fnIndex].blockIndex >= 0)
+        {
+            resolveFunction(resolver, fnIndex);
+        }
+    }
+
+    return !resolver.hasErrors;
+}
+
+static void addExistingGlobals(Resolver& resolver)
+{
+    const MyMemory& mem = resolver.mem;
+    for(u32 slot = 0; slot < mem.globalNames.size(); ++slot)
+    {
+        resolver.globalSlots.insert({mem.globalNames[slot], slot});
+    }
+}
+
+bool resolver_resolveFunction(MyMemory& mem, u32 fnIndex)
+{
+    Resolver resolver{.mem = mem, .nextSlot = 0, .maxSlot = 0, .inFunction = true, .hasErrors = false };
+    addExistingGlobals(resolver);
+    resolveFunction(resolver, fnIndex);
+    return !resolver.hasErrors;
+}
+
+bool resolver_resolveMore(MyMemory& mem, u32 firstFunction, const std::vector<u32>& statementIndices)
+{
+    Resolver resolver{.mem = mem, .nextSlot = 0, .maxSlot = 0, .inFunction = false, .hasErrors = false };
+    addExistingGlobals(resolver);
+
+    // A function declared again takes over the slot of the old one.
+    std::vector<u32> functionSlots;
+    for(u32 fnIndex = firstFunction; fnIndex < mem.functions.size(); ++fnIndex)
+    {
+        Token name = tokens_get(mem.tokens, mem.functions[fnIndex].tokenNameIndex);
+        auto iter = resolver.globalSlots.find(nameSymbol(resolver, name));
+        functionSlots.push_back(iter != resolver.globalSlots.end() ? iter->second : addGlobal(resolver, name));
+    }
+    for(u32 index : statementIndices)
+    {
+        if(index < mem.statements.size() && mem.statements[index].type == StatementType_VarDeclare)
+        {
+            Token name = tokens_get(mem.tokens, mem.statements[index].tokenIndex);
+            if(!resolver.globalSlots.contains(nameSymbol(resolver, name)))
+            {
+                addGlobal(resolver, name);
+            }
+        }
+    }
+
+    resolveStatements(resolver, statementIndices);
+    mem.scriptLocalCount = resolver.maxSlot > mem.scriptLocalCount ? resolver.maxSlot : mem.scriptLocalCount;
+
+    resolver.inFunction = true;
+    for(u32 fnIndex = firstFunction; fnIndex < mem.functions.size(); ++fnIndex)
+    {
+        resolveFunction(resolver, fnIndex);
+    }
+    if(resolver.hasErrors)
+    {
+        return false;
+    }
+    // Bound last, so the old functions stay callable when the input is rejected.
+    for(u32 i = 0; i < functionSlots.size(); ++i)
+    {
+        mem.globals[functionSlots[i]] = ExprValue{.stringIndex = firstFunction + i, .literalType = LiteralType_Function };
+    }
+    return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+
+#include "mytypes.h"
+
+struct MyMemory;
+
+// Runs between ast_generate() and execution. Annotates every variable, assign and
+// var declaration with a (depth, slot) pair:
+//   VarDepth_Global -> slot into mem.globals (top-level vars and functions)
+//   VarDepth_Local  -> slot into the locals of the current frame
+// Block scopes are flattened into the frame, slots are reused once a block ends.
+// Functions whose bodies were skipped are left for resolver_resolveFunction().
+bool resolver_run(MyMemory& mem);
+// Resolves one lazily parsed function against the globals of resolver_run().
+bool resolver_resolveFunction(MyMemory& mem, u32 fnIndex);
+// Resolves input added by ast_generateMore(): the new top-level statements and the
+// functions from firstFunction on. Globals of earlier inputs keep their slots.
+bool resolver_resolveMore(MyMemory& mem, u32 firstFunction, const std::vector<u32>& statementIndices);
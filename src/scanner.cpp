@@ -4,12 +4,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <charconv>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "errors.h"
 #include "helpers.h"
 #include "mymemory.h"
 #include "mytypes.h"
+#include "scanskip.h"
+#include "sourcefile.h"
 #include "token.h"
 
 struct Keyword
@@ -19,9 +24,9 @@ struct Keyword
     u32 len;
 };
 
+// && and || are matched in scanToken(), identifiers always start with a letter.
 static constexpr Keyword keywords[]{
     Keyword{ "and", TokenType::AND, 3 },
-    Keyword{ "&&", TokenType::AND, 2 },
     Keyword{ "class", TokenType::CLASS, 5 },
     Keyword{ "else", TokenType::ELSE, 4 },
     Keyword{ "false", TokenType::FALSE, 5 },
@@ -30,7 +35,6 @@ static constexpr Keyword keywords[]{
     Keyword{ "if", TokenType::IF, 2 },
     Keyword{ "nil", TokenType::NIL, 3 },
     Keyword{ "or", TokenType::OR, 2 },
-    Keyword{ "||", TokenType::OR, 2 },
     Keyword{ "print", TokenType::PRINT, 5 },
     Keyword{ "return", TokenType::RETURN, 6 },
     Keyword{ "super", TokenType::SUPER, 5 },
@@ -38,6 +42,61 @@ static constexpr Keyword keywords[]{
     Keyword{ "var", TokenType::VAR, 3 },
     Keyword{ "while", TokenType::WHILE, 5 },
 };
+static constexpr u32 KeywordCount = sizeof(keywords) / sizeof(Keyword);
+
+// Perfect hash over first char, last char and length, the multiplier is searched at compile time.
+static constexpr u32 KeywordTableSize = 32;
+
+static constexpr u32 keywordHash(u8 first, u8 last, u32 len, u32 mul)
+{
+    return (first + last * mul + len) & (KeywordTableSize - 1);
+}
+
+static constexpr u32 keywordHash(const Keyword& word, u32 mul)
+{
+    return keywordHash((u8)word.name[0], (u8)word.name[word.len - 1], word.len, mul);
+}
+
+static consteval u32 findKeywordHashMul()
+{
+    for(u32 mul = 1; mul < 256; ++mul)
+    {
+        bool used[KeywordTableSize] = {};
+        bool collision = false;
+        for(const Keyword& word : keywords)
+        {
+            u32 bucket = keywordHash(word, mul);
+            collision |= used[bucket];
+            used[bucket] = true;
+        }
+        if(!collision)
+        {
+            return mul;
+        }
+    }
+    return 0;
+}
+
+static constexpr u32 KeywordHashMul = findKeywordHashMul();
+static_assert(KeywordHashMul != 0, "No perfect hash found for keywords, grow KeywordTableSize.");
+
+struct KeywordTable
+{
+    // Keyword index + 1, 0 for empty bucket.
+    u8 entries[KeywordTableSize];
+};
+
+static consteval KeywordTable makeKeywordTable()
+{
+    KeywordTable table{};
+    for(u32 i = 0; i < KeywordCount; ++i)
+    {
+        table.entries[keywordHash(keywords[i], KeywordHashMul)] = (u8)(i + 1);
+    }
+    return table;
+}
+
+static constexpr KeywordTable keywordTable = makeKeywordTable();
 
 
 
@@ -46,6 +105,48 @@ static bool isAtAtEnd(const Scanner& scanner)
     return scanner.pos >= scanner.srcLen;
 }
 
+// Appends the next chunk of a streamed source, false once everything is read.
+static bool refill(Scanner& scanner)
+{
+    // Also keeps parallel chunk scanners inside their chunk.
+    if (scanner.source.complete)
+    {
+        return false;
+    }
+    bool grew = sourceFile_fill(scanner.source);
+    scanner.src = scanner.source.data;
+    scanner.srcLen = (i32)scanner.source.size;
+    return grew;
+}
+
+// Only string literals span lines, so with the rest of the line buffered no
+// other token can be cut at the end of a streamed chunk.
+static void bufferLine(Scanner& scanner)
+{
+    i32 searchFrom = scanner.pos;
+    while (scanner.lineEnd < scanner.pos)
+    {
+        const void* newline = memchr(scanner.src + searchFrom, '\n', scanner.srcLen - searchFrom);
+        if (newline != nullptr)
+        {
+            scanner.lineEnd = (i32)((const u8*)newline - scanner.src);
+            break;
+        }
+        searchFrom = scanner.srcLen;
+        if (!refill(scanner))
+        {
+            scanner.lineEnd = INT32_MAX;
+        }
+    }
+}
+
+static void emitToken(Scanner& scanner, const Token& token)
+{
+    scanner.token = token;
+    scanner.tokenIndex = tokens_add(scanner.tokens, token);
+    scanner.hasToken = true;
+}
+
 static u8 peek(const Scanner& scanner, i32 amount)
 {
     if (scanner.pos + amount >= scanner.srcLen)
@@ -67,7 +168,7 @@ static u8 peek(const Scanner& scanner)
         return '\0';
     }
 
-    return peek(scanner, 0);
+    return scanner.src[scanner.pos];
 }
 
 static u8 advance(Scanner& scanner)
@@ -76,63 +177,51 @@ static u8 advance(Scanner& scanner)
     {
         return '\0';
     }
-    u8 c = peek(scanner);
-    scanner.pos++;
-    return c;
+    return scanner.src[scanner.pos++];
 }
 
-static void addNumberToken(Scanner& scanner)
+static void addNumberToken(Scanner& scanner, TokenType type, const ExprValue& value)
 {
-    std::string s = std::string((const char*)&scanner.src[scanner.start], (size_t)(scanner.pos - scanner.start));
-
-    // TODO fix this atof
-    double d = atof(s.data());
-
-    scanner.mem.tokens.emplace_back(Token{
-        .value = {.doubleValue = d, .literalType = LiteralType_Double },
+    emitToken(scanner, Token{
+        .value = value,
+        .lexemeOffset = (u32)scanner.start,
+        .lexemeLength = (u32)(scanner.pos - scanner.start),
         .line = scanner.line,
-        .type = TokenType::NUMBER,
+        .type = type,
     });
 }
 
-static void addIntToken(Scanner& scanner)
+static void addToken(Scanner& scanner, TokenType type)
 {
-    std::string s = std::string((const char*)&scanner.src[scanner.start], (size_t)(scanner.pos - scanner.start));
-
-    // TODO fix this atof
-    i64 i = atoll(s.data());
-
-    scanner.mem.tokens.emplace_back(Token{
-        .value = {.value = i, .literalType = LiteralType_I64 },
+    emitToken(scanner, Token{
+        .value = {.value = 0, .literalType = LiteralType_None },
+        .lexemeOffset = (u32)scanner.start,
+        .lexemeLength = (u32)(scanner.pos - scanner.start),
         .line = scanner.line,
-        .type = TokenType::INTEGER,
-    });
+        .type = type,
+        });
 }
 
-static void addToken(Scanner& scanner, TokenType type)
+// Only names are interned, the resolver keys variables by symbol id.
+static void addIdentifierToken(Scanner& scanner)
 {
-    LiteralType literalType = type == TokenType::IDENTIFIER
-        ? LiteralType_Identifier
-        : LiteralType_None;
-    u32 index = addString(
-        scanner.mem, std::string((const char*)&scanner.src[scanner.start], (size_t)(scanner.pos - scanner.start)));
-    scanner.mem.tokens.emplace_back(Token{
-        //.lexMe = std::string((const char*)&scanner.src[scanner.start], (size_t)(scanner.pos - scanner.start)),
-        .value = {.stringIndex = index, .literalType = literalType },
+    u32 symbol = interner_add(
+        scanner.symbols, (const char*)&scanner.src[scanner.start], (u32)(scanner.pos - scanner.start));
+    emitToken(scanner, Token{
+        .value = {.symbolIndex = symbol, .literalType = LiteralType_Identifier },
+        .lexemeOffset = (u32)scanner.start,
+        .lexemeLength = (u32)(scanner.pos - scanner.start),
         .line = scanner.line,
-        .type = type,
+        .type = TokenType::IDENTIFIER,
         });
 }
 
 static void handleStringLiteral(Scanner& scanner)
 {
-    while (peek(scanner) != '"' && !isAtAtEnd(scanner))
+    scanner.pos = scanSkip_stringBody(scanner.src, scanner.pos, scanner.srcLen, scanner.line);
+    while (isAtAtEnd(scanner) && refill(scanner))
     {
-        if (peek(scanner) == '\n')
-        {
-            scanner.line++;
-        }
-        advance(scanner);
+        scanner.pos = scanSkip_stringBody(scanner.src, scanner.pos, scanner.srcLen, scanner.line);
     }
 
     if (isAtAtEnd(scanner))
@@ -140,13 +229,11 @@ static void handleStringLiteral(Scanner& scanner)
         reportError(scanner, "Unterminated string!", "");
         return;
     }
-    u32 index = addString(
-        scanner.mem, std::string((const char*)&scanner.src[scanner.start + 1], (size_t)(scanner.pos - scanner.start - 1)));
-
-    scanner.mem.tokens.emplace_back(Token{
+    emitToken(scanner, Token{
+        .value = {.value = 0, .literalType = LiteralType_String },
         // [start + 1, pos]
-        //.lexMe = std::string((const char*)&scanner.src[scanner.start + 1], (size_t)(scanner.pos - scanner.start - 1)),
-        .value = {.stringIndex = index, .literalType = LiteralType_String },
+        .lexemeOffset = (u32)(scanner.start + 1),
+        .lexemeLength = (u32)(scanner.pos - scanner.start - 1),
         .line = scanner.line,
         .type = TokenType::STRING,
         });
@@ -170,47 +257,137 @@ static bool matchChar(Scanner& scanner, char c)
 }
 
 
+static bool isDigitOfBase(u8 c, i32 base)
+{
+    switch (base)
+    {
+        case 2: return c == '0' || c == '1';
+        case 16: return isHexDigit((char)c);
+        default: return isDigit((char)c);
+    }
+}
+
+// An underscore separator is only valid between two digits.
+static void skipDigits(Scanner& scanner, i32 base)
+{
+    while (isDigitOfBase(peek(scanner), base)
+        || (peek(scanner) == '_' && isDigitOfBase(peek(scanner, 1), base)))
+    {
+        advance(scanner);
+    }
+}
+
+// Still emits a 0 so the parser, which pulls tokens as it goes, can carry on.
+static void numberError(Scanner& scanner, const char* message)
+{
+    std::string lexeme((const char*)&scanner.src[scanner.start], (size_t)(scanner.pos - scanner.start));
+    reportError(scanner, message, lexeme);
+    addNumberToken(scanner, TokenType::INTEGER, ExprValue{ .value = 0, .literalType = LiteralType_I64 });
+}
+
+// Digits longer than this after removing separators are always out of range.
+static constexpr i32 NumberBufferSize = 128;
+
+// Handles 123, 1_000_000, 12.5, 0xff_ff and 0b1010. Parsed straight from the
+// source with std::from_chars, no allocation and no locale.
 static void handleNumberString(Scanner& scanner)
 {
-    while (isdigit(peek(scanner)))
+    i32 base = 10;
+    i32 digitsStart = scanner.start;
+    u8 prefix = peek(scanner);
+    if (scanner.src[scanner.start] == '0' && (prefix == 'x' || prefix == 'X' || prefix == 'b' || prefix == 'B'))
     {
+        base = (prefix == 'x' || prefix == 'X') ? 16 : 2;
         advance(scanner);
+        digitsStart = scanner.pos;
+        if (!isDigitOfBase(peek(scanner), base))
+        {
+            scanner.pos = scanSkip_identifier(scanner.src, scanner.pos, scanner.srcLen);
+            numberError(scanner, "Expected digits after number prefix.");
+            return;
+        }
     }
+    skipDigits(scanner, base);
 
-    if (peek(scanner) == '.' && isdigit(peek(scanner, 1)))
+    bool isDouble = false;
+    if (base == 10 && peek(scanner) == '.' && isDigit(peek(scanner, 1)))
     {
+        isDouble = true;
         advance(scanner);
-        while (isdigit(peek(scanner)))
+        skipDigits(scanner, base);
+    }
+
+    if (isAlphaNumUnderscore((char)peek(scanner)))
+    {
+        scanner.pos = scanSkip_identifier(scanner.src, scanner.pos, scanner.srcLen);
+        numberError(scanner, "Invalid character in number literal.");
+        return;
+    }
+
+    const char* first = (const char*)&scanner.src[digitsStart];
+    const char* last = (const char*)&scanner.src[scanner.pos];
+    char buffer[NumberBufferSize];
+    if (memchr(first, '_', last - first) != nullptr)
+    {
+        i32 len = 0;
+        for (const char* c = first; c < last; ++c)
         {
-            advance(scanner);
+            if (*c != '_')
+            {
+                if (len == NumberBufferSize)
+                {
+                    numberError(scanner, "Number literal is too long.");
+                    return;
+                }
+                buffer[len++] = *c;
+            }
         }
-        addNumberToken(scanner);
+        first = buffer;
+        last = buffer + len;
     }
-    else
+
+    if (isDouble)
     {
-        addIntToken(scanner);
+        double d = 0.0;
+        std::from_chars_result result = std::from_chars(first, last, d);
+        if (result.ec != std::errc() || result.ptr != last)
+        {
+            numberError(scanner, "Number literal is out of range.");
+            return;
+        }
+        addNumberToken(scanner, TokenType::NUMBER, ExprValue{ .doubleValue = d, .literalType = LiteralType_Double });
+        return;
     }
 
+    // Hex and binary literals may use all 64 bits, decimal ones have to fit an i64.
+    u64 u = 0;
+    std::from_chars_result result = std::from_chars(first, last, u, base);
+    if (result.ec != std::errc() || result.ptr != last || (base == 10 && u > (u64)INT64_MAX))
+    {
+        numberError(scanner, "Integer literal overflows 64 bits.");
+        return;
+    }
+    addNumberToken(scanner, TokenType::INTEGER, ExprValue{ .value = (i64)u, .literalType = LiteralType_I64 });
 }
 
 static void handleIdentifier(Scanner& scanner)
 {
-    while (isAlphaNumUnderscore((char)peek(scanner)))
-    {
-        advance(scanner);
-    }
+    scanner.pos = scanSkip_identifier(scanner.src, scanner.pos, scanner.srcLen);
     i32 sz = scanner.pos - scanner.start;
     const char* identifier = (const char*)&scanner.src[scanner.start];
-    for (const Keyword& word : keywords)
+    u32 bucket = keywordHash((u8)identifier[0], (u8)identifier[sz - 1], sz, KeywordHashMul);
+    u8 entry = keywordTable.entries[bucket];
+    if (entry != 0)
     {
-        if (sz == word.len && strncmp(identifier, word.name, word.len) == 0)
+        const Keyword& word = keywords[entry - 1];
+        if (sz == word.len && memcmp(identifier, word.name, word.len) == 0)
         {
             addToken(scanner, word.type);
             return;
         }
     }
 
-    addToken(scanner, TokenType::IDENTIFIER);
+    addIdentifierToken(scanner);
 }
 
 
@@ -240,10 +417,7 @@ static void scanToken(Scanner& scanner)
         case '/':
             if (matchChar(scanner, '/'))
             {
-                while (peek(scanner) != '\n' && !isAtAtEnd(scanner))
-                {
-                    advance(scanner);
-                }
+                scanner.pos = scanSkip_untilNewline(scanner.src, scanner.pos, scanner.srcLen);
             }
             else
             {
@@ -267,11 +441,11 @@ static void scanToken(Scanner& scanner)
         default:
         {
             bool handled = false;
-            if (isdigit(c))
+            if (isDigit(c))
             {
                 handleNumberString(scanner);
             }
-            else if (isalpha(c))
+            else if (isAlpha(c))
             {
                 handleIdentifier(scanner);
             }
@@ -293,35 +467,194 @@ static void scanToken(Scanner& scanner)
 
 }
 
-bool scanner_run(MyMemory& mem, bool printTokens)
+Scanner scanner_begin(MyMemory& mem)
+{
+    return scanner_beginAt(mem, 0, 1);
+}
+
+Scanner scanner_beginAt(MyMemory& mem, u32 offset, i32 line)
 {
-    Scanner scanner = {
-        .mem = mem,
-        .src = mem.scriptFileData.data(),
-        .srcLen = (i32) mem.scriptFileData.size(),
-        .pos = 0,
-        .start = 0,
-        .line = 1
+    return Scanner{
+        .tokens = mem.tokens,
+        .symbols = mem.symbols,
+        .source = mem.source,
+        .src = mem.source.data,
+        .srcLen = (i32) mem.source.size,
+        .pos = (i32)offset,
+        .start = (i32)offset,
+        .line = line,
+        .lineEnd = mem.source.complete ? INT32_MAX : -1,
     };
+}
+
+u32 scanner_next(Scanner& scanner, Token& outToken)
+{
+    if (!scanner.prescanned.empty())
+    {
+        if (!scanner.finished)
+        {
+            const Token& token = scanner.prescanned[scanner.prescannedPos++];
+            emitToken(scanner, token);
+            scanner.finished = token.type == TokenType::END_OF_FILE;
+        }
+        outToken = scanner.token;
+        return scanner.tokenIndex;
+    }
 
-    while (!isAtAtEnd(scanner))
+    scanner.hasToken = false;
+    while (!scanner.hasToken && !scanner.finished)
     {
+        scanner.pos = scanSkip_whitespace(scanner.src, scanner.pos, scanner.srcLen, scanner.line);
+        if (isAtAtEnd(scanner))
+        {
+            if (refill(scanner))
+            {
+                continue;
+            }
+            scanner.start = scanner.pos;
+            emitToken(scanner, Token{
+                .lexemeOffset = (u32)scanner.pos,
+                .line = scanner.line,
+                .type = TokenType::END_OF_FILE
+                });
+            scanner.finished = true;
+            break;
+        }
+        bufferLine(scanner);
         scanner.start = scanner.pos;
         scanToken(scanner);
     }
+    outToken = scanner.token;
+    return scanner.tokenIndex;
+}
 
-    scanner.mem.tokens.emplace_back(Token{
-        //.lexMe = "",
-        .line = scanner.line,
-        .type = TokenType::END_OF_FILE
-        });
+// Below this a chunk is not worth a thread.
+static constexpr u32 MinScanChunkSize = 256 * 1024;
 
-    if(printTokens)
+struct ScanChunk
+{
+    i32 begin;
+    i32 end;
+    std::vector<Token> tokens;
+    TokenStore store;
+    Interner symbols;
+    i32 newlineCount;
+    bool ok;
+};
+
+static void scanChunk(SourceFile& source, ScanChunk& chunk)
+{
+    Scanner scanner{
+        .tokens = chunk.store,
+        .symbols = chunk.symbols,
+        .source = source,
+        .src = source.data,
+        .srcLen = chunk.end,
+        .pos = chunk.begin,
+        .start = chunk.begin,
+        .line = 1,
+        .lineEnd = INT32_MAX,
+        .silent = true,
+    };
+    Token token;
+    do
+    {
+        scanner_next(scanner, token);
+        chunk.tokens.push_back(token);
+    } while (token.type != TokenType::END_OF_FILE);
+
+    // A '\0' in the source ends the script early, leave that to the sequential path.
+    chunk.ok = scanner.finished && !scanner.hasErrors;
+    chunk.newlineCount = scanner.line - 1;
+}
+
+bool scanner_prescan(Scanner& scanner, u32 threadCount)
+{
+    if (!scanner.source.complete || scanner.source.size == 0 || scanner.pos != 0 || threadCount == 0)
+    {
+        return false;
+    }
+
+    u32 size = scanner.source.size;
+    u32 chunkCount = threadCount;
+    if (chunkCount > size / MinScanChunkSize)
+    {
+        chunkCount = size / MinScanChunkSize > 0 ? size / MinScanChunkSize : 1;
+    }
+
+    // Chunks start right after a new line, comments never span one.
+    std::vector<ScanChunk> chunks(chunkCount);
+    i32 begin = 0;
+    u32 used = 0;
+    for (u32 i = 0; i < chunkCount && begin < (i32)size; ++i)
+    {
+        i32 end = (i32)size;
+        if (i + 1 < chunkCount)
+        {
+            i32 target = (i32)((u64)size * (i + 1) / chunkCount);
+            target = target > begin ? target : begin;
+            const void* newline = memchr(scanner.src + target, '\n', size - target);
+            end = newline != nullptr ? (i32)((const u8*)newline - scanner.src) + 1 : (i32)size;
+        }
+        chunks[used].begin = begin;
+        chunks[used].end = end;
+        used++;
+        begin = end;
+    }
+    chunks.resize(used);
+
+    std::vector<std::thread> workers;
+    for (u32 i = 1; i < chunks.size(); ++i)
+    {
+        workers.emplace_back(scanChunk, std::ref(scanner.source), std::ref(chunks[i]));
+    }
+    if (!chunks.empty())
+    {
+        scanChunk(scanner.source, chunks[0]);
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    for (const ScanChunk& chunk : chunks)
+    {
+        if (!chunk.ok)
+        {
+            return false;
+        }
+    }
+
+    // Merge, shifting lines and mapping chunk local symbols to the shared interner.
+    std::vector<Token>& merged = scanner.prescanned;
+    i32 lineBase = 0;
+    std::vector<u32> remap;
+    for (u32 i = 0; i < chunks.size(); ++i)
     {
-        for (const Token &token: scanner.mem.tokens)
+        const ScanChunk& chunk = chunks[i];
+        remap.assign(chunk.symbols.symbols.size(), ~0u);
+        bool last = i + 1 == chunks.size();
+        for (const Token& token : chunk.tokens)
         {
-            printToken(scanner.mem, token);
+            if (token.type == TokenType::END_OF_FILE && !last)
+            {
+                break;
+            }
+            Token& out = merged.emplace_back(token);
+            out.line += lineBase;
+            if (token.type == TokenType::IDENTIFIER)
+            {
+                u32& symbol = remap[token.value.symbolIndex];
+                if (symbol == ~0u)
+                {
+                    std::string_view name = interner_get(chunk.symbols, token.value.symbolIndex);
+                    symbol = interner_add(scanner.symbols, name.data(), (u32)name.size());
+                }
+                out.value.symbolIndex = symbol;
+            }
         }
+        lineBase += chunk.newlineCount;
     }
+    scanner.prescannedPos = 0;
     return true;
 }
@@ -5,18 +5,48 @@
 #include "mytypes.h"
 #include "token.h"
 
+struct Interner;
 struct MyMemory;
+struct SourceFile;
+struct TokenStore;
 
+// Pull based, the parser asks for one token at a time with scanner_next().
+// Every token is appended to tokens, the value only travels in the
+// returned Token.
 struct Scanner
 {
-    MyMemory& mem;
+    TokenStore& tokens;
+    Interner& symbols;
+    SourceFile& source;
     const u8* src;
     i32 srcLen;
     i32 pos;
     i32 start;
     i32 line;
+    // Streams only, a new line at or after pos is buffered up to here.
+    i32 lineEnd;
+    Token token;
+    u32 tokenIndex;
+    bool hasToken;
+    bool finished;
+    // Filled by scanner_prescan(), scanner_next() hands these out in order.
+    std::vector<Token> prescanned;
+    u32 prescannedPos;
+    // Set on parallel chunk scanners, the sequential rescan reports the errors.
+    bool silent;
     bool hasErrors;
 };
 
-bool scanner_run(MyMemory& mem, bool printTokens);
+Scanner scanner_begin(MyMemory& mem);
+// Starts in the middle of the source, offset must be outside of any token.
+Scanner scanner_beginAt(MyMemory& mem, u32 offset, i32 line);
+// Returns the index of the next token in mem.tokens. Keeps returning the
+// END_OF_FILE token once the source is exhausted.
+u32 scanner_next(Scanner& scanner, Token& outToken);
+// Scans the whole source up front on threadCount threads. The source is split
+// after new lines, a split inside a multi line string shows up as an
+// unterminated string in the chunk before it. Returns false and leaves the
+// scanner untouched when that happens, when a chunk has errors or when the
+// source is streamed, the parser then scans on demand as usual.
+bool scanner_prescan(Scanner& scanner, u32 threadCount);
 
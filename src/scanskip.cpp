@@ -0,0 +1,171 @@
+#include "scanskip.h"
+
+#include <bit>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define CARP_SCAN_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define CARP_SCAN_SSE2 1
+#endif
+
+#if CARP_SCAN_AVX2
+
+using Block = __m256i;
+static constexpr i32 BlockSize = 32;
+
+static Block loadBlock(const u8* p) { return _mm256_loadu_si256((const __m256i*)p); }
+static Block splat(char c) { return _mm256_set1_epi8(c); }
+static Block orBlock(Block a, Block b) { return _mm256_or_si256(a, b); }
+static Block eqByte(Block b, char c) { return _mm256_cmpeq_epi8(b, splat(c)); }
+// Signed compare, bytes over 127 never fall in an ascii range.
+static Block inRange(Block b, char lo, char hi)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(b, splat(lo - 1)), _mm256_cmpgt_epi8(splat(hi + 1), b));
+}
+static u32 toMask(Block b) { return (u32)_mm256_movemask_epi8(b); }
+
+#elif CARP_SCAN_SSE2
+
+using Block = __m128i;
+static constexpr i32 BlockSize = 16;
+
+static Block loadBlock(const u8* p) { return _mm_loadu_si128((const __m128i*)p); }
+static Block splat(char c) { return _mm_set1_epi8(c); }
+static Block orBlock(Block a, Block b) { return _mm_or_si128(a, b); }
+static Block eqByte(Block b, char c) { return _mm_cmpeq_epi8(b, splat(c)); }
+// Signed compare, bytes over 127 never fall in an ascii range.
+static Block inRange(Block b, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(b, splat(lo - 1)), _mm_cmplt_epi8(b, splat(hi + 1)));
+}
+static u32 toMask(Block b) { return (u32)_mm_movemask_epi8(b); }
+
+#endif
+
+#define CARP_SCAN_BLOCKS (CARP_SCAN_AVX2 || CARP_SCAN_SSE2)
+
+#if CARP_SCAN_BLOCKS
+static constexpr u32 FullMask = BlockSize == 32 ? ~0u : (1u << BlockSize) - 1;
+
+static u32 lowBits(u32 count)
+{
+    return count >= 32 ? ~0u : (1u << count) - 1;
+}
+
+static u32 newlineMask(Block b) { return toMask(eqByte(b, '\n')); }
+
+static u32 whitespaceMask(Block b)
+{
+    return toMask(orBlock(
+        orBlock(eqByte(b, ' '), eqByte(b, '\t')),
+        orBlock(eqByte(b, '\r'), eqByte(b, '\n'))));
+}
+
+static u32 identifierMask(Block b)
+{
+    // Setting bit 5 folds upper case onto lower case without creating new letters.
+    Block lower = orBlock(b, splat(0x20));
+    return toMask(orBlock(
+        orBlock(inRange(b, '0', '9'), inRange(lower, 'a', 'z')),
+        eqByte(b, '_')));
+}
+#endif
+
+static bool isWhitespace(u8 c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+i32 scanSkip_whitespace(const u8* src, i32 pos, i32 len, i32& line)
+{
+#if CARP_SCAN_BLOCKS
+    while(pos + BlockSize <= len)
+    {
+        Block b = loadBlock(src + pos);
+        u32 inRun = whitespaceMask(b);
+        u32 newlines = newlineMask(b);
+        if(inRun != FullMask)
+        {
+            u32 runLength = (u32)std::countr_zero(~inRun);
+            line += std::popcount(newlines & lowBits(runLength));
+            return pos + runLength;
+        }
+        line += std::popcount(newlines);
+        pos += BlockSize;
+    }
+#endif
+    while(pos < len && isWhitespace(src[pos]))
+    {
+        line += src[pos] == '\n';
+        pos++;
+    }
+    return pos;
+}
+
+i32 scanSkip_untilNewline(const u8* src, i32 pos, i32 len)
+{
+#if CARP_SCAN_BLOCKS
+    while(pos + BlockSize <= len)
+    {
+        u32 newlines = newlineMask(loadBlock(src + pos));
+        if(newlines != 0)
+        {
+            return pos + std::countr_zero(newlines);
+        }
+        pos += BlockSize;
+    }
+#endif
+    while(pos < len && src[pos] != '\n')
+    {
+        pos++;
+    }
+    return pos;
+}
+
+i32 scanSkip_identifier(const u8* src, i32 pos, i32 len)
+{
+#if CARP_SCAN_BLOCKS
+    while(pos + BlockSize <= len)
+    {
+        u32 inRun = identifierMask(loadBlock(src + pos));
+        if(inRun != FullMask)
+        {
+            return pos + std::countr_zero(~inRun);
+        }
+        pos += BlockSize;
+    }
+#endif
+    while(pos < len && isAlphaNumUnderscore((char)src[pos]))
+    {
+        pos++;
+    }
+    return pos;
+}
+
+i32 scanSkip_stringBody(const u8* src, i32 pos, i32 len, i32& line)
+{
+#if CARP_SCAN_BLOCKS
+    while(pos + BlockSize <= len)
+    {
+        Block b = loadBlock(src + pos);
+        u32 quotes = toMask(eqByte(b, '"'));
+        u32 newlines = newlineMask(b);
+        if(quotes != 0)
+        {
+            u32 runLength = (u32)std::countr_zero(quotes);
+            line += std::popcount(newlines & lowBits(runLength));
+            return pos + runLength;
+        }
+        line += std::popcount(newlines);
+        pos += BlockSize;
+    }
+#endif
+    while(pos < len && src[pos] != '"')
+    {
+        line += src[pos] == '\n';
+        pos++;
+    }
+    return pos;
+}
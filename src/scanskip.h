@@ -0,0 +1,16 @@
+#pragma once
+
+#include "mytypes.h"
+
+// Bulk skipping of scanner runs, vectorized with AVX2 or SSE2 when the target
+// has them and scalar otherwise. Each returns the position of the first byte
+// that does not belong to the run, or len.
+
+// Spaces, tabs, carriage returns and new lines, counts the new lines into line.
+i32 scanSkip_whitespace(const u8* src, i32 pos, i32 len, i32& line);
+// Comment body, stops on the new line.
+i32 scanSkip_untilNewline(const u8* src, i32 pos, i32 len);
+// Letters, digits and underscores.
+i32 scanSkip_identifier(const u8* src, i32 pos, i32 len);
+// String literal body, stops on the closing quote and counts the new lines into line.
+i32 scanSkip_stringBody(const u8* src, i32 pos, i32 len, i32& line);
@@ -0,0 +1,201 @@
+#include "sourcefile.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "errors.h"
+
+#if _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+    #include <io.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// The scanner indexes with i32.
+static constexpr u64 MaxSourceSize = INT32_MAX;
+static constexpr u32 StreamChunkSize = 64 * 1024;
+
+static bool readOwned(SourceFile& file, FILE* stream)
+{
+    u8 buffer[64 * 1024];
+    size_t count;
+    while((count = fread(buffer, 1, sizeof(buffer), stream)) > 0)
+    {
+        file.owned.insert(file.owned.end(), buffer, buffer + count);
+        if(file.owned.size() > MaxSourceSize)
+        {
+            LOG_ERROR("Source file is too big.");
+            return false;
+        }
+    }
+    file.data = file.owned.data();
+    file.size = (u32)file.owned.size();
+    return true;
+}
+
+static bool readOwned(SourceFile& file, const char* filename)
+{
+    FILE* stream = fopen(filename, "rb");
+    if(stream == nullptr)
+    {
+        LOG_ERROR("Failed to open file.");
+        return false;
+    }
+    bool result = readOwned(file, stream);
+    fclose(stream);
+    return result;
+}
+
+#if _WIN32
+
+static bool mapFile(SourceFile& file, const char* filename)
+{
+    HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER size{};
+    if(!GetFileSizeEx(handle, &size) || size.QuadPart == 0 || (u64)size.QuadPart > MaxSourceSize)
+    {
+        CloseHandle(handle);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(handle);
+    if(mapping == nullptr)
+    {
+        return false;
+    }
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(view == nullptr)
+    {
+        CloseHandle(mapping);
+        return false;
+    }
+    file.data = (const u8*)view;
+    file.size = (u32)size.QuadPart;
+    file.mapping = mapping;
+    return true;
+}
+
+static void unmapFile(SourceFile& file)
+{
+    UnmapViewOfFile(file.data);
+    CloseHandle((HANDLE)file.mapping);
+}
+
+#else
+
+static bool mapFile(SourceFile& file, const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+    {
+        return false;
+    }
+    struct stat st{};
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || (u64)st.st_size > MaxSourceSize)
+    {
+        close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(view == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+    file.data = (const u8*)view;
+    file.size = (u32)st.st_size;
+    file.mapping = view;
+    return true;
+}
+
+static void unmapFile(SourceFile& file)
+{
+    munmap(file.mapping, file.size);
+}
+
+#endif
+
+static void reset(SourceFile& file)
+{
+    file.data = nullptr;
+    file.size = 0;
+    file.mapping = nullptr;
+    file.owned.clear();
+    file.stream = nullptr;
+    file.complete = true;
+}
+
+bool sourceFile_open(SourceFile& file, const char* filename)
+{
+    reset(file);
+
+    // Empty files and anything that is not a regular file cannot be mapped.
+    if(mapFile(file, filename))
+    {
+        return true;
+    }
+    return readOwned(file, filename);
+}
+
+void sourceFile_openStream(SourceFile& file, FILE* stream)
+{
+    reset(file);
+    file.data = file.owned.data();
+    file.stream = stream;
+    file.complete = false;
+}
+
+bool sourceFile_fill(SourceFile& file)
+{
+    if(file.complete)
+    {
+        return false;
+    }
+    size_t oldSize = file.owned.size();
+    file.owned.resize(oldSize + StreamChunkSize);
+    // Unlike fread, read returns as soon as some bytes are available.
+#if _WIN32
+    int count = _read(_fileno(file.stream), file.owned.data() + oldSize, StreamChunkSize);
+#else
+    ssize_t count = read(fileno(file.stream), file.owned.data() + oldSize, StreamChunkSize);
+#endif
+    if(count <= 0 || oldSize + count > MaxSourceSize)
+    {
+        if(count > 0)
+        {
+            LOG_ERROR("Source file is too big.");
+        }
+        count = 0;
+        file.complete = true;
+    }
+    file.owned.resize(oldSize + count);
+    file.data = file.owned.data();
+    file.size = (u32)file.owned.size();
+    return count > 0;
+}
+
+void sourceFile_close(SourceFile& file)
+{
+    if(file.mapping != nullptr)
+    {
+        unmapFile(file);
+    }
+    file.data = nullptr;
+    file.size = 0;
+    file.mapping = nullptr;
+    file.owned.clear();
+    file.stream = nullptr;
+    file.complete = true;
+}
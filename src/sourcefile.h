@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "mytypes.h"
+
+// Script source, memory-mapped when possible so the bytes exist only once.
+// Tokens keep (offset, length) views into data, it must outlive the parse.
+struct SourceFile
+{
+    const u8* data;
+    u32 size;
+    // Mapping handle, null when the source was read into owned.
+    void* mapping;
+    // Fallback for files that cannot be mapped, and the buffer of streams.
+    std::vector<u8> owned;
+    // Set for streamed sources, read chunk by chunk with sourceFile_fill().
+    FILE* stream;
+    // All of the source is in data.
+    bool complete;
+};
+
+bool sourceFile_open(SourceFile& file, const char* filename);
+// Starts empty, the scanner pulls chunks as it needs them. data moves when
+// the buffer grows, hold offsets not pointers.
+void sourceFile_openStream(SourceFile& file, FILE* stream);
+// Appends whatever the stream has available, blocking only while nothing is.
+// Returns false once the stream is exhausted.
+bool sourceFile_fill(SourceFile& file);
+void sourceFile_close(SourceFile& file);
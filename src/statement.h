@@ -1,5 +1,6 @@
 #pragma once
 
+#include "expr.h"
 #include "mytypes.h"
 
 enum StatementType : u8
@@ -27,7 +28,12 @@ struct Statement
     };
     union
     {
-        u32 tokenIndex;
+        struct // var declare
+        {
+            u32 tokenIndex;
+            VarDepth varDepth;
+            u32 varSlot;
+        };
         u32 whileStatementIndex;
         struct
         {
@@ -37,8 +43,14 @@ struct Statement
         struct // call
         {
             u32 tokenNameIndex;
-            u32 paramsNameIndices[4];
-            u32 paramsNameIndicesCount;
+            // Parameter name tokens are mem.paramNames[paramsStart, paramsStart + paramsCount).
+            u32 paramsStart;
+            u32 paramsCount;
+            u32 localSlotCount;
+            // Token range of the body from '{' to '}'. blockIndex stays -1 until
+            // a lazily skipped body is parsed on the first call.
+            u32 bodyStart;
+            u32 bodyEnd;
         };
     };
     StatementType type;
@@ -0,0 +1,446 @@
+#include "stringheap.h"
+
+#include <stdio.h>
+
+#include "expr.h"
+#include "interner.h"
+#include "mymemory.h"
+#include "value.h"
+
+#include <algorithm>
+
+// Collections start once this much was allocated, then whenever the live
+// bytes doubled since the last one.
+static constexpr u64 StringHeap_FirstCollection = 1 << 20;
+// Shorter concatenations are copied, a node would cost about as much.
+static constexpr u64 StringHeap_MinRopeLength = 64;
+// A rope node accounted like that many characters.
+static constexpr u64 StringHeap_RopeBytes = sizeof(StringRope) + sizeof(std::string);
+static constexpr u32 StringHeap_InitialInternTableSize = 256;
+
+static bool isRope(const StringHeap& heap, u32 stringIndex)
+{
+    return stringIndex < heap.ropes.size() && heap.ropes[stringIndex].length > 0;
+}
+
+static u64 slotBytes(const MyMemory& mem, u32 stringIndex)
+{
+    return isRope(mem.stringHeap, stringIndex) ? StringHeap_RopeBytes : mem.strings[stringIndex].size();
+}
+
+static void addLiveBytes(StringHeap& heap, u64 size)
+{
+    heap.liveBytes += size;
+    heap.stats.peakBytes = heap.liveBytes > heap.stats.peakBytes ? heap.liveBytes : heap.stats.peakBytes;
+}
+
+static u32 textHash(const std::string& str)
+{
+    u32 hash = interner_hash(str.data(), str.size());
+    return hash != 0 ? hash : 1;
+}
+
+static u32 findInternBucket(const MyMemory& mem, const std::string& str, u32 hash)
+{
+    const StringHeap& heap = mem.stringHeap;
+    u32 mask = heap.internTable.size() - 1;
+    for(u32 bucket = hash & mask;; bucket = (bucket + 1) & mask)
+    {
+        u32 entry = heap.internTable[bucket];
+        if(entry == 0 || (heap.hashes[entry - 1] == hash && mem.strings[entry - 1] == str))
+        {
+            return bucket;
+        }
+    }
+}
+
+static void rebuildInternTable(MyMemory& mem)
+{
+    StringHeap& heap = mem.stringHeap;
+    u32 size = StringHeap_InitialInternTableSize;
+    while(size < heap.internedCount * 2 + 2)
+    {
+        size *= 2;
+    }
+    heap.internTable.assign(size, 0);
+    for(u32 i = 0; i < heap.interned.size(); ++i)
+    {
+        if(heap.interned[i])
+        {
+            u32 bucket = findInternBucket(mem, mem.strings[i], heap.hashes[i]);
+            heap.internTable[bucket] = i + 1;
+        }
+    }
+}
+
+static void insertInterned(MyMemory& mem, u32 bucket, u32 stringIndex, u32 hash)
+{
+    StringHeap& heap = mem.stringHeap;
+    heap.hashes[stringIndex] = hash;
+    heap.interned[stringIndex] = true;
+    heap.internTable[bucket] = stringIndex + 1;
+    heap.internedCount++;
+    // Keep load factor under one half.
+    if(heap.internedCount * 2 > heap.internTable.size())
+    {
+        rebuildInternTable(mem);
+    }
+}
+
+u32 stringHeap_add(MyMemory& mem, std::string&& str)
+{
+    StringHeap& heap = mem.stringHeap;
+    addLiveBytes(heap, str.size());
+    if(!heap.freeSlots.empty())
+    {
+        u32 stringIndex = heap.freeSlots.back();
+        heap.freeSlots.pop_back();
+        mem.strings[stringIndex] = std::move(str);
+        return stringIndex;
+    }
+    mem.strings.emplace_back(std::move(str));
+    heap.hashes.push_back(0);
+    heap.interned.push_back(false);
+    return mem.strings.size() - 1;
+}
+
+u32 stringHeap_intern(MyMemory& mem, std::string&& str)
+{
+    StringHeap& heap = mem.stringHeap;
+    if(heap.internTable.empty())
+    {
+        rebuildInternTable(mem);
+    }
+    u32 hash = textHash(str);
+    u32 bucket = findInternBucket(mem, str, hash);
+    if(heap.internTable[bucket] != 0)
+    {
+        return heap.internTable[bucket] - 1;
+    }
+    u32 stringIndex = stringHeap_add(mem, std::move(str));
+    insertInterned(mem, bucket, stringIndex, hash);
+    return stringIndex;
+}
+
+void stringHeap_reset(MyMemory& mem)
+{
+    StringHeap& heap = mem.stringHeap;
+    u64 limit = heap.limit;
+    heap = StringHeap{};
+    heap.limit = limit;
+    heap.hashes.assign(mem.strings.size(), 0);
+    heap.interned.assign(mem.strings.size(), false);
+    rebuildInternTable(mem);
+    // Older caches may hold the same text twice, the first one is interned.
+    for(u32 i = 0; i < mem.strings.size(); ++i)
+    {
+        addLiveBytes(heap, mem.strings[i].size());
+        u32 hash = textHash(mem.strings[i]);
+        u32 bucket = findInternBucket(mem, mem.strings[i], hash);
+        if(heap.internTable[bucket] == 0)
+        {
+            insertInterned(mem, bucket, i, hash);
+        }
+        else
+        {
+            heap.hashes[i] = hash;
+        }
+    }
+}
+
+void stringHeap_truncate(MyMemory& mem, u32 count)
+{
+    StringHeap& heap = mem.stringHeap;
+    for(u32 i = count; i < mem.strings.size(); ++i)
+    {
+        heap.liveBytes -= slotBytes(mem, i);
+        heap.internedCount -= heap.interned[i] ? 1 : 0;
+    }
+    mem.strings.resize(count);
+    heap.hashes.resize(count);
+    heap.interned.resize(count);
+    if(heap.ropes.size() > count)
+    {
+        heap.ropes.resize(count);
+    }
+    std::erase_if(heap.freeSlots, [count](u32 stringIndex) { return stringIndex >= count; });
+    rebuildInternTable(mem);
+}
+
+u32 stringHeap_concat(MyMemory& mem, u32 left, u32 right)
+{
+    u64 length = stringHeap_length(mem, left) + stringHeap_length(mem, right);
+    if(length < StringHeap_MinRopeLength)
+    {
+        std::string s;
+        s.reserve(length);
+        stringHeap_append(mem, left, s);
+        stringHeap_append(mem, right, s);
+        return stringHeap_add(mem, std::move(s));
+    }
+    u32 stringIndex = stringHeap_add(mem, std::string());
+    StringHeap& heap = mem.stringHeap;
+    if(stringIndex >= heap.ropes.size())
+    {
+        heap.ropes.resize(stringIndex + 1, StringRope{});
+    }
+    heap.ropes[stringIndex] = StringRope{ .left = left, .right = right, .length = length };
+    addLiveBytes(heap, StringHeap_RopeBytes);
+    return stringIndex;
+}
+
+u64 stringHeap_concatBytes(const MyMemory& mem, u32 left, u32 right)
+{
+    u64 length = stringHeap_length(mem, left) + stringHeap_length(mem, right);
+    return length < StringHeap_MinRopeLength ? length : StringHeap_RopeBytes;
+}
+
+u64 stringHeap_length(const MyMemory& mem, u32 stringIndex)
+{
+    const StringHeap& heap = mem.stringHeap;
+    return isRope(heap, stringIndex) ? heap.ropes[stringIndex].length : mem.strings[stringIndex].size();
+}
+
+const std::string& stringHeap_flatten(MyMemory& mem, u32 stringIndex)
+{
+    StringHeap& heap = mem.stringHeap;
+    if(isRope(heap, stringIndex))
+    {
+        std::string s;
+        stringHeap_append(mem, stringIndex, s);
+        heap.liveBytes -= StringHeap_RopeBytes;
+        addLiveBytes(heap, s.size());
+        mem.strings[stringIndex] = std::move(s);
+        heap.ropes[stringIndex].length = 0;
+    }
+    return mem.strings[stringIndex];
+}
+
+u32 stringHeap_hash(MyMemory& mem, u32 stringIndex)
+{
+    StringHeap& heap = mem.stringHeap;
+    if(heap.hashes[stringIndex] == 0)
+    {
+        heap.hashes[stringIndex] = textHash(stringHeap_flatten(mem, stringIndex));
+    }
+    return heap.hashes[stringIndex];
+}
+
+bool stringHeap_equal(MyMemory& mem, u32 left, u32 right)
+{
+    if(left == right)
+    {
+        return true;
+    }
+    // Each interned text exists once.
+    if(mem.stringHeap.interned[left] && mem.stringHeap.interned[right])
+    {
+        return false;
+    }
+    if(stringHeap_length(mem, left) != stringHeap_length(mem, right)
+        || stringHeap_hash(mem, left) != stringHeap_hash(mem, right))
+    {
+        return false;
+    }
+    // Hashing flattened both.
+    return mem.strings[left] == mem.strings[right];
+}
+
+static u64 flattenBytes(const MyMemory& mem, u32 stringIndex)
+{
+    const StringHeap& heap = mem.stringHeap;
+    if(!isRope(heap, stringIndex))
+    {
+        return 0;
+    }
+    u64 length = heap.ropes[stringIndex].length;
+    return length > StringHeap_RopeBytes ? length - StringHeap_RopeBytes : 0;
+}
+
+u64 stringHeap_compareBytes(const MyMemory& mem, u32 left, u32 right, bool equalityOnly)
+{
+    if(left == right)
+    {
+        return 0;
+    }
+    // The shortcuts of stringHeap_equal() that never flatten.
+    if(equalityOnly && ((mem.stringHeap.interned[left] && mem.stringHeap.interned[right])
+        || stringHeap_length(mem, left) != stringHeap_length(mem, right)))
+    {
+        return 0;
+    }
+    return flattenBytes(mem, left) + flattenBytes(mem, right);
+}
+
+i32 stringHeap_compare(MyMemory& mem, u32 left, u32 right)
+{
+    if(left == right)
+    {
+        return 0;
+    }
+    const std::string& leftString = stringHeap_flatten(mem, left);
+    const std::string& rightString = stringHeap_flatten(mem, right);
+    return leftString.compare(rightString);
+}
+
+// Calls visit for each flat piece of a rope from left to right.
+template<typename Visit>
+static void forEachPiece(const MyMemory& mem, u32 stringIndex, Visit&& visit)
+{
+    const StringHeap& heap = mem.stringHeap;
+    // Not recursive, s = s + piece in a loop makes ropes as deep as the loop ran.
+    std::vector<u32> pending { stringIndex };
+    while(!pending.empty())
+    {
+        u32 i = pending.back();
+        pending.pop_back();
+        if(isRope(heap, i))
+        {
+            pending.push_back(heap.ropes[i].right);
+            pending.push_back(heap.ropes[i].left);
+        }
+        else
+        {
+            visit(mem.strings[i]);
+        }
+    }
+}
+
+void stringHeap_append(const MyMemory& mem, u32 stringIndex, std::string& out)
+{
+    const StringHeap& heap = mem.stringHeap;
+    if(!isRope(heap, stringIndex))
+    {
+        out += mem.strings[stringIndex];
+        return;
+    }
+    out.reserve(out.size() + heap.ropes[stringIndex].length);
+    forEachPiece(mem, stringIndex, [&out](const std::string& piece) { out += piece; });
+}
+
+void stringHeap_write(const MyMemory& mem, u32 stringIndex, FILE* file)
+{
+    forEachPiece(mem, stringIndex, [file](const std::string& piece) { fwrite(piece.data(), 1, piece.size(), file); });
+}
+
+bool stringHeap_wantsCollection(const MyMemory& mem, u64 size)
+{
+    const StringHeap& heap = mem.stringHeap;
+    u64 threshold = heap.nextCollection > 0 ? heap.nextCollection : StringHeap_FirstCollection;
+    return heap.liveBytes + size > threshold || !stringHeap_fits(mem, size);
+}
+
+bool stringHeap_fits(const MyMemory& mem, u64 size)
+{
+    const StringHeap& heap = mem.stringHeap;
+    return heap.limit == 0 || heap.liveBytes + size <= heap.limit;
+}
+
+void stringHeap_mark(MyMemory& mem, u32 stringIndex)
+{
+    // A rope keeps its operands, the stack is reused over the collection.
+    StringHeap& heap = mem.stringHeap;
+    heap.markStack.push_back(stringIndex);
+    while(!heap.markStack.empty())
+    {
+        u32 i = heap.markStack.back();
+        heap.markStack.pop_back();
+        if(heap.marks[i])
+        {
+            continue;
+        }
+        heap.marks[i] = true;
+        if(isRope(heap, i))
+        {
+            heap.markStack.push_back(heap.ropes[i].left);
+            heap.markStack.push_back(heap.ropes[i].right);
+        }
+    }
+}
+
+void stringHeap_mark(MyMemory& mem, const ExprValue& value)
+{
+    if(value.literalType == LiteralType_String)
+    {
+        stringHeap_mark(mem, value.stringIndex);
+    }
+}
+
+void stringHeap_beginCollection(MyMemory& mem)
+{
+    StringHeap& heap = mem.stringHeap;
+    heap.marks.assign(mem.strings.size(), false);
+    for(const ExprValue& literal : mem.literals)
+    {
+        stringHeap_mark(mem, literal);
+    }
+    for(Value constant : mem.constants)
+    {
+        if(isString(constant))
+        {
+            stringHeap_mark(mem, asStringIndex(constant));
+        }
+    }
+    // The vm runs on its own copy, these are only current between runs.
+    for(const ExprValue& global : mem.globals)
+    {
+        stringHeap_mark(mem, global);
+    }
+    for(u32 stringIndex : heap.pinned)
+    {
+        stringHeap_mark(mem, stringIndex);
+    }
+    // Already free slots count as marked, they are not freed twice.
+    for(u32 stringIndex : heap.freeSlots)
+    {
+        heap.marks[stringIndex] = true;
+    }
+}
+
+void stringHeap_sweep(MyMemory& mem)
+{
+    StringHeap& heap = mem.stringHeap;
+    u64 liveBytes = 0;
+    bool internedFreed = false;
+    for(u32 i = 0; i < mem.strings.size(); ++i)
+    {
+        if(heap.marks[i])
+        {
+            liveBytes += slotBytes(mem, i);
+            continue;
+        }
+        heap.stats.freedStrings++;
+        heap.stats.freedBytes += slotBytes(mem, i);
+        // Swapping with an empty string gives the buffer back.
+        std::string().swap(mem.strings[i]);
+        if(i < heap.ropes.size())
+        {
+            heap.ropes[i].length = 0;
+        }
+        heap.hashes[i] = 0;
+        if(heap.interned[i])
+        {
+            heap.interned[i] = false;
+            heap.internedCount--;
+            internedFreed = true;
+        }
+        heap.freeSlots.push_back(i);
+    }
+    // Only dropped parser input frees interned strings, literals are roots.
+    if(internedFreed)
+    {
+        rebuildInternTable(mem);
+    }
+    heap.stats.collections++;
+    heap.liveBytes = liveBytes;
+    heap.nextCollection = liveBytes * 2 > StringHeap_FirstCollection ? liveBytes * 2 : StringHeap_FirstCollection;
+}
+
+void stringHeap_printStats(const MyMemory& mem)
+{
+    const StringHeap& heap = mem.stringHeap;
+    printf("string heap: %llu collections, freed %llu strings / %llu bytes, live %llu bytes, peak %llu bytes\n",
+        (unsigned long long)heap.stats.collections, (unsigned long long)heap.stats.freedStrings,
+        (unsigned long long)heap.stats.freedBytes, (unsigned long long)heap.liveBytes,
+        (unsigned long long)heap.stats.peakBytes);
+}
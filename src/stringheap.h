@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "mytypes.h"
+
+struct MyMemory;
+struct ExprValue;
+
+struct StringHeapStats
+{
+    u64 collections;
+    u64 freedStrings;
+    u64 freedBytes;
+    u64 peakBytes;
+};
+
+// Concatenation result that is only copied together when its characters are
+// needed, its slot in mem.strings stays empty.
+struct StringRope
+{
+    u32 left;
+    u32 right;
+    // 0 for a flat string.
+    u64 length;
+};
+
+// Strings stay indices into mem.strings, a collection frees the unreachable
+// slots and addString() reuses them. Strings never change once added, the
+// text of addString() is interned so equal literals share one index. Only the runtimes collect, at the points
+// where they create a string and know every value they hold. Strings
+// referenced by mem.literals, mem.constants, mem.globals and pinned are
+// always kept.
+struct StringHeap
+{
+    std::vector<u32> freeSlots;
+    std::vector<bool> marks;
+    // Indexed by string, shorter than mem.strings when the last ones are flat.
+    std::vector<StringRope> ropes;
+    std::vector<u32> markStack;
+    // Per string, 0 until the first stringHeap_hash().
+    std::vector<u32> hashes;
+    std::vector<bool> interned;
+    // Open addressing over the interned strings, holds string index + 1.
+    std::vector<u32> internTable;
+    u32 internedCount;
+    // Held by native code while the runtime may allocate.
+    std::vector<u32> pinned;
+    // Characters in mem.strings plus the rope nodes.
+    u64 liveBytes;
+    u64 nextCollection;
+    // Live bytes a runtime may not grow past, 0 for no limit.
+    u64 limit;
+    StringHeapStats stats;
+};
+
+// Takes a slot from the free list when there is one.
+u32 stringHeap_add(MyMemory& mem, std::string&& str);
+// Returns the interned string with this text, adding it when there is none.
+u32 stringHeap_intern(MyMemory& mem, std::string&& str);
+// For mem.strings filled or cut outside stringHeap_add(), see programcache.cpp
+// and ast_generateMore().
+void stringHeap_reset(MyMemory& mem);
+void stringHeap_truncate(MyMemory& mem, u32 count);
+// Joins two strings, long results become a rope sharing both operands.
+u32 stringHeap_concat(MyMemory& mem, u32 left, u32 right);
+// Bytes stringHeap_concat() adds to the heap, for the collection checks.
+u64 stringHeap_concatBytes(const MyMemory& mem, u32 left, u32 right);
+u64 stringHeap_length(const MyMemory& mem, u32 stringIndex);
+void stringHeap_append(const MyMemory& mem, u32 stringIndex, std::string& out);
+// Writes the characters piece by piece, a rope is never copied together.
+void stringHeap_write(const MyMemory& mem, u32 stringIndex, FILE* file);
+// Copies a rope together once and keeps the result, its operands may be freed then.
+const std::string& stringHeap_flatten(MyMemory& mem, u32 stringIndex);
+// Cached after the first call, never 0.
+u32 stringHeap_hash(MyMemory& mem, u32 stringIndex);
+// Index compare for two interned strings, otherwise length, hash, then bytes.
+bool stringHeap_equal(MyMemory& mem, u32 left, u32 right);
+// Byte wise like std::string::compare().
+i32 stringHeap_compare(MyMemory& mem, u32 left, u32 right);
+// Bytes stringHeap_equal(), or stringHeap_compare() when not equalityOnly,
+// add to the heap by flattening, for the collection checks.
+u64 stringHeap_compareBytes(const MyMemory& mem, u32 left, u32 right, bool equalityOnly);
+
+// Whether adding size bytes should collect first.
+bool stringHeap_wantsCollection(const MyMemory& mem, u64 size);
+// Whether size more bytes still fit under the limit.
+bool stringHeap_fits(const MyMemory& mem, u64 size);
+
+// A collection is begin, marking whatever the runtime holds, then sweep.
+void stringHeap_beginCollection(MyMemory& mem);
+void stringHeap_mark(MyMemory& mem, const ExprValue& value);
+void stringHeap_mark(MyMemory& mem, u32 stringIndex);
+void stringHeap_sweep(MyMemory& mem);
+
+void stringHeap_printStats(const MyMemory& mem);
@@ -5,23 +5,67 @@
 
 #include <string>
 
-std::string getTokenValueAsString(const MyMemory& mem, const Token& token)
+std::string_view getTokenLexeme(const MyMemory& mem, const Token& token)
 {
+    if(token.lexemeLength == 0)
+    {
+        return std::string_view();
+    }
+    return std::string_view((const char*)mem.source.data + token.lexemeOffset, token.lexemeLength);
+}
+
+std::string_view getTokenLexeme(const MyMemory& mem, u32 tokenIndex)
+{
+    const TokenLexeme& lexeme = mem.tokens.lexemes[tokenIndex];
+    return std::string_view((const char*)mem.source.data + lexeme.offset, lexeme.length);
+}
+
+u32 tokens_add(TokenStore& store, const Token& token)
+{
+    u32 index = tokens_count(store);
+    store.types.push_back(token.type);
+    store.lexemes.push_back(TokenLexeme{ .offset = token.lexemeOffset, .length = token.lexemeLength });
+    if(store.lineRuns.empty() || store.lineRuns.back().line != token.line)
+    {
+        store.lineRuns.push_back(TokenLineRun{ .firstToken = index, .line = token.line });
+    }
+    return index;
+}
 
-    switch(token.type)
+i32 tokens_line(const TokenStore& store, u32 index)
+{
+    // Last run starting at or before index.
+    u32 low = 0;
+    u32 high = (u32)store.lineRuns.size();
+    while(high - low > 1)
     {
-        case TokenType::INTEGER:
-            return std::to_string(token.value.value);
-        case TokenType::NUMBER:
-            return std::to_string(token.value.doubleValue);
-        default:
-            return mem.strings[token.value.stringIndex];
+        u32 mid = (low + high) / 2;
+        if(store.lineRuns[mid].firstToken <= index)
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid;
+        }
     }
+    return store.lineRuns.empty() ? 0 : store.lineRuns[low].line;
+}
 
+Token tokens_get(const TokenStore& store, u32 index)
+{
+    const TokenLexeme& lexeme = store.lexemes[index];
+    return Token{
+        .value = {},
+        .lexemeOffset = lexeme.offset,
+        .lexemeLength = lexeme.length,
+        .line = tokens_line(store, index),
+        .type = store.types[index],
+    };
 }
 
 void printToken(const MyMemory& mem, const Token& token)
 {
     const char* tokenTypeName = TOKEN_NAMES[(i32)token.type];
-    printf("Token type: %s, %s, literal?\n", tokenTypeName, getTokenValueAsString(mem, token).data());
+    printf("Token type: %s, %s, literal?\n", tokenTypeName, std::string(getTokenLexeme(mem, token)).data());
 }
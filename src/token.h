@@ -3,6 +3,7 @@
 #include "expr.h"
 #include "mytypes.h"
 #include <string>
+#include <string_view>
 #include <vector>
 
 struct MyMemory;
@@ -61,16 +62,58 @@ static const char* TOKEN_NAMES[] = {
 };
 static_assert(sizeof(TOKEN_NAMES) / sizeof(const char*) == (i32)(TokenType::END_OF_FILE) + 1);
 
+// What the scanner hands to the parser. The value is not kept in the
+// TokenStore, tokens_get() returns it empty.
 struct Token
 {
-    // ?
-    //std::string lexMe;
+    // Literal value, the interned name for identifiers.
     ExprValue value;
+    // Lexeme as a view into the source, see sourcefile.h. Strings exclude the quotes.
+    u32 lexemeOffset;
+    u32 lexemeLength;
     i32 line;
     TokenType type;
 
 };
 
-std::string getTokenValueAsString(const MyMemory& mem, const Token& token);
+struct TokenLexeme
+{
+    u32 offset;
+    u32 length;
+};
+
+// Consecutive tokens from firstToken up to the next run share the line.
+struct TokenLineRun
+{
+    u32 firstToken;
+    i32 line;
+};
+
+// Structure of arrays token stream, kept after parsing for operator types,
+// lines and error messages. Literal values live in the AST instead.
+struct TokenStore
+{
+    std::vector<TokenType> types;
+    std::vector<TokenLexeme> lexemes;
+    std::vector<TokenLineRun> lineRuns;
+};
+
+u32 tokens_add(TokenStore& store, const Token& token);
+Token tokens_get(const TokenStore& store, u32 index);
+// Binary search over the line runs.
+i32 tokens_line(const TokenStore& store, u32 index);
+
+static u32 tokens_count(const TokenStore& store)
+{
+    return (u32)store.types.size();
+}
+
+static TokenType tokens_type(const TokenStore& store, u32 index)
+{
+    return store.types[index];
+}
+
+std::string_view getTokenLexeme(const MyMemory& mem, const Token& token);
+std::string_view getTokenLexeme(const MyMemory& mem, u32 tokenIndex);
 void printToken(const MyMemory& mem, const Token& token);
 
@@ -0,0 +1,392 @@
+#include "typeinfer.h"
+
+#include <vector>
+
+#include "expr.h"
+#include "helpers.h"
+#include "mymemory.h"
+#include "statement.h"
+#include "token.h"
+
+static constexpr u32 NoFunction = ~0u;
+
+struct TypeInfer
+{
+    MyMemory& mem;
+    // Types are only ever widened, the passes repeat until nothing changed.
+    std::vector<u8> globals;
+    // The function a global slot is bound to, as long as nothing assigns it.
+    std::vector<u32> globalFunctions;
+    // Indexed like mem.paramNames.
+    std::vector<u8> params;
+    std::vector<u8> returns;
+    // Read as a value, it can be called from anywhere with anything.
+    std::vector<bool> escaped;
+    // Locals of the function being walked, by frame slot.
+    std::vector<u8> locals;
+    u8 returnType;
+    // Cleared by a return, the statements after it only run when jumped to.
+    bool reachable;
+    bool changed;
+};
+
+static u8 widen(TypeInfer& infer, u8& type, u8 with)
+{
+    if((type | with) != type)
+    {
+        type |= with;
+        infer.changed = true;
+    }
+    return type;
+}
+
+static bool isSingleType(u8 type)
+{
+    return type != 0 && (type & (type - 1)) == 0;
+}
+
+static u8 literalType(const ExprValue& value)
+{
+    switch(value.literalType)
+    {
+        case LiteralType_I64: return StaticType_Int;
+        case LiteralType_Double: return StaticType_Double;
+        case LiteralType_Boolean: return StaticType_Bool;
+        case LiteralType_String: return StaticType_String;
+        case LiteralType_Null: return StaticType_Nil;
+        case LiteralType_Function: return StaticType_Function;
+        case LiteralType_None: return StaticType_None;
+        default: return StaticType_Any;
+    }
+}
+
+// Same rules as the binary ops of evaluate() and the vm. Type pairs those
+// reject end the program and add nothing.
+static u8 binaryType(TokenType operType, u8 left, u8 right)
+{
+    bool arithmetic = operType == TokenType::PLUS || operType == TokenType::MINUS
+        || operType == TokenType::STAR || operType == TokenType::SLASH;
+    u8 numbers = StaticType_Int | StaticType_Double;
+    u8 result = 0;
+    if((left & StaticType_Int) && (right & StaticType_Int))
+    {
+        result |= arithmetic ? StaticType_Int : StaticType_Bool;
+    }
+    if(((left & StaticType_Double) && (right & numbers)) || ((left & numbers) && (right & StaticType_Double)))
+    {
+        result |= arithmetic ? StaticType_Double : StaticType_Bool;
+    }
+    // Strings concatenate with + and compare, other operators reject them.
+    if((left & StaticType_String) && (right & StaticType_String))
+    {
+        if(operType == TokenType::PLUS)
+        {
+            result |= StaticType_String;
+        }
+        else if(!arithmetic)
+        {
+            result |= StaticType_Bool;
+        }
+    }
+    return result;
+}
+
+static void inferStatement(TypeInfer& infer, u32 statementIndex);
+static u8 inferExpression(TypeInfer& infer, u32 exprIndex);
+
+static void joinLocals(std::vector<u8>& into, const std::vector<u8>& other)
+{
+    for(u32 i = 0; i < into.size(); ++i)
+    {
+        into[i] |= other[i];
+    }
+}
+
+static u8 inferVariable(TypeInfer& infer, const Expr& expr, bool callee)
+{
+    if(expr.varDepth == VarDepth_Local)
+    {
+        return infer.locals[expr.varSlot];
+    }
+    u32 fnIndex = infer.globalFunctions[expr.varSlot];
+    if(!callee && fnIndex != NoFunction && !infer.escaped[fnIndex])
+    {
+        infer.escaped[fnIndex] = true;
+        infer.changed = true;
+    }
+    return infer.globals[expr.varSlot];
+}
+
+static void assignVariable(TypeInfer& infer, VarDepth depth, u32 slot, u8 type)
+{
+    if(depth == VarDepth_Local)
+    {
+        infer.locals[slot] = type;
+        return;
+    }
+    widen(infer, infer.globals[slot], type);
+    if(infer.globalFunctions[slot] != NoFunction)
+    {
+        // The slot may hold anything now, calls through it are unknown.
+        infer.globalFunctions[slot] = NoFunction;
+        infer.changed = true;
+    }
+}
+
+static u8 inferCall(TypeInfer& infer, const Expr& expr)
+{
+    MyMemory& mem = infer.mem;
+    const Expr& callee = mem.expressions[expr.callee];
+    u32 fnIndex = NoFunction;
+    if(callee.exprType == ExprType_Variable)
+    {
+        inferVariable(infer, callee, true);
+        fnIndex = callee.varDepth == VarDepth_Global ? infer.globalFunctions[callee.varSlot] : NoFunction;
+    }
+    else
+    {
+        inferExpression(infer, expr.callee);
+    }
+    bool known = fnIndex != NoFunction && mem.functions[fnIndex].paramsCount == expr.argCount;
+    for(u32 i = 0; i < expr.argCount; ++i)
+    {
+        u8 argType = inferExpression(infer, mem.callArgs[expr.argsStart + i]);
+        if(known)
+        {
+            widen(infer, infer.params[mem.functions[fnIndex].paramsStart + i], argType);
+        }
+    }
+    return known ? (StaticType)infer.returns[fnIndex] : StaticType_Any;
+}
+
+static u8 inferExpression(TypeInfer& infer, u32 exprIndex)
+{
+    MyMemory& mem = infer.mem;
+    const Expr& expr = mem.expressions[exprIndex];
+    u8 type = StaticType_Any;
+    switch(expr.exprType)
+    {
+        case ExprType_None:
+            break;
+        case ExprType_Literal:
+            type = literalType(mem.literals[expr.literalIndex]);
+            break;
+        case ExprType_Unary:
+        {
+            u8 right = inferExpression(infer, expr.rightExprIndex);
+            type = getTokenOperType(mem, expr) == TokenType::BANG ? (u8)StaticType_Bool
+                : (u8)(right & (StaticType_Int | StaticType_Double));
+        }
+        break;
+        case ExprType_Binary:
+        {
+            u8 left = inferExpression(infer, expr.leftExprIndex);
+            u8 right = inferExpression(infer, expr.rightExprIndex);
+            type = binaryType(getTokenOperType(mem, expr), left, right);
+        }
+        break;
+        case ExprType_Logical:
+        {
+            // The right side may not run, its assignments may not have happened.
+            u8 left = inferExpression(infer, expr.leftExprIndex);
+            std::vector<u8> afterLeft = infer.locals;
+            u8 right = inferExpression(infer, expr.rightExprIndex);
+            joinLocals(infer.locals, afterLeft);
+            type = left | right;
+        }
+        break;
+        case ExprType_Variable:
+            type = inferVariable(infer, expr, false);
+            break;
+        case ExprType_Assign:
+        {
+            type = inferExpression(infer, expr.rightExprIndex);
+            assignVariable(infer, expr.varDepth, expr.varSlot, type);
+        }
+        break;
+        case ExprType_CallFn:
+            type = inferCall(infer, expr);
+            break;
+    }
+    // Joined over every visit, an expression is seen once per pass and loop round.
+    mem.exprTypes[exprIndex] |= type;
+    return type;
+}
+
+static void inferStatements(TypeInfer& infer, const std::vector<u32>& statementIndices)
+{
+    for(u32 index : statementIndices)
+    {
+        // Function declarations live in mem.functions and leave ~0 in the block.
+        if(index < infer.mem.statements.size())
+        {
+            inferStatement(infer, index);
+        }
+    }
+}
+
+static void inferStatement(TypeInfer& infer, u32 statementIndex)
+{
+    MyMemory& mem = infer.mem;
+    const Statement& statement = mem.statements[statementIndex];
+    switch(statement.type)
+    {
+        case StatementType_Expression:
+        case StatementType_Print:
+            inferExpression(infer, statement.expressionIndex);
+            break;
+        case StatementType_VarDeclare:
+        {
+            u8 type = inferExpression(infer, statement.expressionIndex);
+            assignVariable(infer, statement.varDepth, statement.varSlot, type);
+        }
+        break;
+        case StatementType_Block:
+            inferStatements(infer, mem.blocks[statement.blockIndex].statementIndices);
+            break;
+        case StatementType_If:
+        {
+            inferExpression(infer, statement.expressionIndex);
+            bool reachable = infer.reachable;
+            std::vector<u8> afterCondition = infer.locals;
+            inferStatement(infer, statement.ifStatementIndex);
+            bool thenReachable = infer.reachable;
+            std::vector<u8> afterThen = infer.locals;
+            infer.locals = afterCondition;
+            infer.reachable = reachable;
+            if(statement.elseStatementIndex < mem.statements.size())
+            {
+                inferStatement(infer, statement.elseStatementIndex);
+            }
+            // A branch ending in a return adds nothing to what follows.
+            if(!infer.reachable)
+            {
+                infer.locals = afterThen;
+            }
+            else if(thenReachable)
+            {
+                joinLocals(infer.locals, afterThen);
+            }
+            infer.reachable = thenReachable || infer.reachable;
+        }
+        break;
+        case StatementType_While:
+        {
+            // Rounds until the locals at the top of the loop stop growing, the
+            // loop is left with the condition false on that state.
+            bool reachable = infer.reachable;
+            std::vector<u8> loopEntry = infer.locals;
+            for(;;)
+            {
+                infer.locals = loopEntry;
+                infer.reachable = reachable;
+                inferExpression(infer, statement.expressionIndex);
+                std::vector<u8> afterCondition = infer.locals;
+                inferStatement(infer, statement.whileStatementIndex);
+                std::vector<u8> nextEntry = loopEntry;
+                if(infer.reachable)
+                {
+                    joinLocals(nextEntry, infer.locals);
+                }
+                if(nextEntry == loopEntry)
+                {
+                    infer.locals = afterCondition;
+                    infer.reachable = reachable;
+                    break;
+                }
+                loopEntry = nextEntry;
+            }
+        }
+        break;
+        case StatementType_Return:
+        {
+            u8 type = statement.expressionIndex != ~0u ? inferExpression(infer, statement.expressionIndex) : (u8)StaticType_None;
+            infer.returnType |= type;
+            infer.reachable = false;
+        }
+        break;
+        case StatementType_CallFn:
+        case StatementType_Count:
+            break;
+    }
+}
+
+static void inferFunction(TypeInfer& infer, u32 fnIndex)
+{
+    MyMemory& mem = infer.mem;
+    const Statement& function = mem.functions[fnIndex];
+    infer.locals.assign(function.localSlotCount, 0);
+    for(u32 i = 0; i < function.paramsCount; ++i)
+    {
+        infer.locals[i] = infer.escaped[fnIndex] ? (u8)StaticType_Any : infer.params[function.paramsStart + i];
+    }
+    infer.returnType = 0;
+    infer.reachable = true;
+    inferStatements(infer, mem.blocks[function.blockIndex].statementIndices);
+    // Falling off the end returns no value.
+    infer.returnType |= infer.reachable ? (u8)StaticType_None : 0;
+    widen(infer, infer.returns[fnIndex], infer.returnType);
+}
+
+TypeInferStats typeInfer_run(MyMemory& mem)
+{
+    TypeInfer infer{ .mem = mem };
+    infer.globals.assign(mem.globals.size(), 0);
+    infer.globalFunctions.assign(mem.globals.size(), NoFunction);
+    infer.params.assign(mem.paramNames.size(), 0);
+    infer.returns.assign(mem.functions.size(), 0);
+    mem.exprTypes.assign(mem.expressions.size(), 0);
+
+    // Skipped bodies are not seen, they may assign anything to any global and
+    // call any function with anything.
+    bool skippedBodies = false;
+    for(u32 fnIndex = 0; fnIndex < mem.functions.size(); ++fnIndex)
+    {
+        skippedBodies |= mem.functions[fnIndex].blockIndex < 0;
+        infer.returns[fnIndex] = mem.functions[fnIndex].blockIndex < 0 ? (u8)StaticType_Any : 0;
+    }
+    infer.escaped.assign(mem.functions.size(), skippedBodies);
+    for(u32 slot = 0; slot < mem.globals.size(); ++slot)
+    {
+        const ExprValue& global = mem.globals[slot];
+        infer.globals[slot] = skippedBodies ? (u8)StaticType_Any : global.literalType == LiteralType_None ? 0 : literalType(global);
+        infer.globalFunctions[slot] = global.literalType == LiteralType_Function && !skippedBodies ? global.stringIndex : NoFunction;
+    }
+
+    do
+    {
+        infer.changed = false;
+        infer.reachable = true;
+        infer.locals.assign(mem.scriptLocalCount, 0);
+        inferStatements(infer, mem.blocks[0].statementIndices);
+        for(u32 fnIndex = 0; fnIndex < mem.functions.size(); ++fnIndex)
+        {
+            if(mem.functions[fnIndex].blockIndex >= 0)
+            {
+                inferFunction(infer, fnIndex);
+            }
+        }
+    } while(infer.changed);
+
+    // Only reachable nodes got a type, the optimizer leaves unreachable copies behind.
+    TypeInferStats stats{};
+    for(u32 i = 0; i < mem.expressions.size(); ++i)
+    {
+        const Expr& expr = mem.expressions[i];
+        if(expr.exprType == ExprType_Binary && mem.exprTypes[i] != 0)
+        {
+            stats.binaryOps++;
+            bool proven = isSingleType(typeInfer_exprType(mem, expr.leftExprIndex))
+                && isSingleType(typeInfer_exprType(mem, expr.rightExprIndex));
+            stats.provenBinaryOps += proven ? 1 : 0;
+        }
+    }
+    return stats;
+}
+
+StaticType typeInfer_exprType(const MyMemory& mem, u32 exprIndex)
+{
+    // Never evaluated counts as unknown, a lazily parsed body for example.
+    u8 type = exprIndex < mem.exprTypes.size() ? mem.exprTypes[exprIndex] : 0;
+    return type != 0 ? (StaticType)type : StaticType_Any;
+}
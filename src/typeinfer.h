@@ -0,0 +1,35 @@
+#pragma once
+
+#include "mytypes.h"
+
+struct MyMemory;
+
+// Set of the runtime types an expression may produce, one bit per type.
+enum StaticType : u8
+{
+    StaticType_Int = 1 << 0,
+    StaticType_Double = 1 << 1,
+    StaticType_Bool = 1 << 2,
+    StaticType_String = 1 << 3,
+    StaticType_Nil = 1 << 4,
+    StaticType_Function = 1 << 5,
+    // Result of a function returning without a value.
+    StaticType_None = 1 << 6,
+    StaticType_Any = (1 << 7) - 1,
+};
+
+struct TypeInferStats
+{
+    u32 binaryOps;
+    // Binary ops with both operand types known, their number checks are skipped.
+    u32 provenBinaryOps;
+};
+
+// Runs after resolver_run(), fills mem.exprTypes. Locals are tracked flow
+// sensitive through each function, globals get every type assigned to them
+// anywhere. Parameters take the argument types of the direct calls, as long
+// as the function value is never read for anything but a call. Repeats over
+// the whole program until no type grows anymore.
+TypeInferStats typeInfer_run(MyMemory& mem);
+// StaticType_Any for expressions the last typeInfer_run() did not see.
+StaticType typeInfer_exprType(const MyMemory& mem, u32 exprIndex);
@@ -0,0 +1,116 @@
+#include "value.h"
+
+#include "errors.h"
+#include "mymemory.h"
+
+#include <assert.h>
+
+#if CARP_NAN_BOXING
+
+// Collections start at this many live boxes, then whenever they doubled.
+static constexpr u32 BoxedInts_FirstCollection = 1 << 16;
+
+Value makeBoxedInt(MyMemory& mem, i64 i)
+{
+    BoxedInts& boxes = mem.boxedInts;
+    boxes.liveCount++;
+    if(!boxes.freeSlots.empty())
+    {
+        u32 slot = boxes.freeSlots.back();
+        boxes.freeSlots.pop_back();
+        boxes.values[slot] = i;
+        return Value{ makeTagBits(NanBoxTag_BoxedInt, slot) };
+    }
+    // The payload holds 32 bits, reuse keeps the slot count at the live peak.
+    assert(boxes.values.size() < (u64(1) << 32));
+    boxes.values.push_back(i);
+    return Value{ makeTagBits(NanBoxTag_BoxedInt, boxes.values.size() - 1) };
+}
+
+i64 getBoxedInt(const MyMemory& mem, Value v)
+{
+    assert(hasTag(v, NanBoxTag_BoxedInt));
+    return mem.boxedInts.values[getPayload(v)];
+}
+
+bool boxedInts_wantsCollection(const MyMemory& mem)
+{
+    const BoxedInts& boxes = mem.boxedInts;
+    u32 threshold = boxes.nextCollection > 0 ? boxes.nextCollection : BoxedInts_FirstCollection;
+    return boxes.liveCount >= threshold;
+}
+
+void boxedInts_beginCollection(MyMemory& mem)
+{
+    BoxedInts& boxes = mem.boxedInts;
+    boxes.marks.assign(boxes.values.size(), false);
+    for(Value constant : mem.constants)
+    {
+        boxedInts_mark(mem, constant);
+    }
+    // Already free slots count as marked, they are not freed twice.
+    for(u32 slot : boxes.freeSlots)
+    {
+        boxes.marks[slot] = true;
+    }
+}
+
+void boxedInts_mark(MyMemory& mem, Value v)
+{
+    if(hasTag(v, NanBoxTag_BoxedInt))
+    {
+        mem.boxedInts.marks[getPayload(v)] = true;
+    }
+}
+
+void boxedInts_sweep(MyMemory& mem)
+{
+    BoxedInts& boxes = mem.boxedInts;
+    u32 freed = 0;
+    for(u32 slot = 0; slot < boxes.values.size(); ++slot)
+    {
+        if(!boxes.marks[slot])
+        {
+            boxes.freeSlots.push_back(slot);
+            freed++;
+        }
+    }
+    boxes.liveCount -= freed;
+    boxes.nextCollection = boxes.liveCount * 2 > BoxedInts_FirstCollection ? boxes.liveCount * 2 : BoxedInts_FirstCollection;
+}
+
+#endif
+
+Value toValue(MyMemory& mem, const ExprValue& exprValue)
+{
+    switch(exprValue.literalType)
+    {
+        case LiteralType_None: return makeNone();
+        case LiteralType_Null: return makeNil();
+        case LiteralType_Boolean: return makeBool(exprValue.value != 0);
+        case LiteralType_I64: return makeInt(mem, exprValue.value);
+        case LiteralType_Double: return makeDouble(exprValue.doubleValue);
+        case LiteralType_String: return makeString(exprValue.stringIndex);
+        case LiteralType_Function: return makeFunction(exprValue.stringIndex);
+        case LiteralType_Identifier: break;
+    }
+    reportError(-1, "Literal type cannot be a value", "");
+    return makeNone();
+}
+
+ExprValue toExprValue(const MyMemory& mem, Value v)
+{
+    if(isDouble(v))
+        return ExprValue{ .doubleValue = asDouble(v), .literalType = LiteralType_Double };
+    if(isInt(v))
+        return ExprValue{ .value = asInt(mem, v), .literalType = LiteralType_I64 };
+    if(isBool(v))
+        return ExprValue{ .value = asBool(v) ? ~(i64(0)) : 0, .literalType = LiteralType_Boolean };
+    if(isString(v))
+        return ExprValue{ .stringIndex = asStringIndex(v), .literalType = LiteralType_String };
+    if(isFunction(v))
+        return ExprValue{ .stringIndex = asFunctionIndex(v), .literalType = LiteralType_Function };
+    if(isNil(v))
+        return ExprValue{ .value = 0, .literalType = LiteralType_Null };
+    return ExprValue{ .value = 0, .literalType = LiteralType_None };
+}
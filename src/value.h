@@ -0,0 +1,172 @@
+#pragma once
+
+#include <string.h>
+#include <vector>
+
+#include "expr.h"
+#include "mytypes.h"
+
+// Runtime value of the bytecode vm.
+// With CARP_NAN_BOXING the value is 8 bytes: doubles are stored as is, every other
+// type lives in the payload of a quiet NaN. Ints that do not fit into the 50 bit
+// payload are boxed into mem.boxedInts. Without it Value just wraps the 16 byte ExprValue.
+#ifndef CARP_NAN_BOXING
+#define CARP_NAN_BOXING 0
+#endif
+
+#if CARP_NAN_BOXING
+
+struct Value
+{
+    u64 bits;
+};
+static_assert(sizeof(Value) == 8);
+
+static constexpr u64 NanBox_SignBit = 0x8000000000000000ull;
+static constexpr u64 NanBox_QNan = 0x7ffc000000000000ull;
+static constexpr u64 NanBox_CanonicalNan = 0x7ff8000000000000ull;
+
+// Sign bit + quiet nan -> 50 bit signed int in the low bits.
+static constexpr u64 NanBox_IntTag = NanBox_SignBit | NanBox_QNan;
+static constexpr u64 NanBox_IntPayloadMask = (u64(1) << 50) - 1;
+static constexpr i64 NanBox_IntMax = (i64(1) << 49) - 1;
+static constexpr i64 NanBox_IntMin = -(i64(1) << 49);
+
+// Quiet nan without sign bit -> 3 bit type tag in bits 47..49, 32 bit payload.
+enum NanBoxTag : u64
+{
+    NanBoxTag_None = 1,
+    NanBoxTag_Nil = 2,
+    NanBoxTag_Bool = 3,
+    NanBoxTag_String = 4,
+    NanBoxTag_Function = 5,
+    NanBoxTag_BoxedInt = 6,
+};
+static constexpr u64 NanBox_TagShift = 47;
+static constexpr u64 NanBox_TagMask = u64(7) << NanBox_TagShift;
+
+static constexpr u64 makeTagBits(NanBoxTag tag, u32 payload)
+{
+    return NanBox_QNan | (u64(tag) << NanBox_TagShift) | payload;
+}
+
+static bool isDouble(Value v) { return (v.bits & NanBox_QNan) != NanBox_QNan; }
+static bool isSmallInt(Value v) { return (v.bits & NanBox_IntTag) == NanBox_IntTag; }
+static bool hasTag(Value v, NanBoxTag tag) { return (v.bits & (NanBox_IntTag | NanBox_TagMask)) == makeTagBits(tag, 0); }
+
+static bool isInt(Value v) { return isSmallInt(v) || hasTag(v, NanBoxTag_BoxedInt); }
+static bool isNone(Value v) { return hasTag(v, NanBoxTag_None); }
+static bool isNil(Value v) { return hasTag(v, NanBoxTag_Nil); }
+static bool isBool(Value v) { return hasTag(v, NanBoxTag_Bool); }
+static bool isString(Value v) { return hasTag(v, NanBoxTag_String); }
+static bool isFunction(Value v) { return hasTag(v, NanBoxTag_Function); }
+
+static u32 getPayload(Value v) { return (u32)v.bits; }
+
+static Value makeNone() { return Value{ makeTagBits(NanBoxTag_None, 0) }; }
+static Value makeNil() { return Value{ makeTagBits(NanBoxTag_Nil, 0) }; }
+static Value makeBool(bool b) { return Value{ makeTagBits(NanBoxTag_Bool, b ? 1 : 0) }; }
+static Value makeString(u32 stringIndex) { return Value{ makeTagBits(NanBoxTag_String, stringIndex) }; }
+static Value makeFunction(u32 fnIndex) { return Value{ makeTagBits(NanBoxTag_Function, fnIndex) }; }
+
+static Value makeDouble(double d)
+{
+    Value v;
+    memcpy(&v.bits, &d, sizeof(double));
+    // Hardware nans never collide with the tags, but a nan with payload could.
+    if((v.bits & NanBox_QNan) == NanBox_QNan)
+    {
+        v.bits = NanBox_CanonicalNan | (v.bits & NanBox_SignBit);
+    }
+    return v;
+}
+
+static double asDouble(Value v)
+{
+    double d;
+    memcpy(&d, &v.bits, sizeof(double));
+    return d;
+}
+
+static bool asBool(Value v) { return getPayload(v) != 0; }
+static u32 asStringIndex(Value v) { return getPayload(v); }
+static u32 asFunctionIndex(Value v) { return getPayload(v); }
+
+struct MyMemory;
+Value makeBoxedInt(MyMemory& mem, i64 i);
+i64 getBoxedInt(const MyMemory& mem, Value v);
+
+static Value makeInt(MyMemory& mem, i64 i)
+{
+    if(i >= NanBox_IntMin && i <= NanBox_IntMax)
+    {
+        return Value{ NanBox_IntTag | ((u64)i & NanBox_IntPayloadMask) };
+    }
+    return makeBoxedInt(mem, i);
+}
+
+static i64 asInt(const MyMemory& mem, Value v)
+{
+    if(isSmallInt(v))
+    {
+        // Sign extend the 50 bit payload.
+        return (i64)((v.bits & NanBox_IntPayloadMask) << 14) >> 14;
+    }
+    return getBoxedInt(mem, v);
+}
+
+#else
+
+struct Value
+{
+    ExprValue exprValue;
+};
+
+static bool isDouble(Value v) { return v.exprValue.literalType == LiteralType_Double; }
+static bool isInt(Value v) { return v.exprValue.literalType == LiteralType_I64; }
+static bool isNone(Value v) { return v.exprValue.literalType == LiteralType_None; }
+static bool isNil(Value v) { return v.exprValue.literalType == LiteralType_Null; }
+static bool isBool(Value v) { return v.exprValue.literalType == LiteralType_Boolean; }
+static bool isString(Value v) { return v.exprValue.literalType == LiteralType_String; }
+static bool isFunction(Value v) { return v.exprValue.literalType == LiteralType_Function; }
+
+static Value makeNone() { return Value{ ExprValue{ .value = 0, .literalType = LiteralType_None } }; }
+static Value makeNil() { return Value{ ExprValue{ .value = 0, .literalType = LiteralType_Null } }; }
+static Value makeBool(bool b) { return Value{ ExprValue{ .value = b ? ~(i64(0)) : 0, .literalType = LiteralType_Boolean } }; }
+static Value makeString(u32 stringIndex) { return Value{ ExprValue{ .stringIndex = stringIndex, .literalType = LiteralType_String } }; }
+static Value makeFunction(u32 fnIndex) { return Value{ ExprValue{ .stringIndex = fnIndex, .literalType = LiteralType_Function } }; }
+static Value makeDouble(double d) { return Value{ ExprValue{ .doubleValue = d, .literalType = LiteralType_Double } }; }
+
+static double asDouble(Value v) { return v.exprValue.doubleValue; }
+static bool asBool(Value v) { return v.exprValue.value != 0; }
+static u32 asStringIndex(Value v) { return v.exprValue.stringIndex; }
+static u32 asFunctionIndex(Value v) { return v.exprValue.stringIndex; }
+
+struct MyMemory;
+static Value makeInt([[maybe_unused]] MyMemory& mem, i64 i) { return Value{ ExprValue{ .value = i, .literalType = LiteralType_I64 } }; }
+static i64 asInt([[maybe_unused]] const MyMemory& mem, Value v) { return v.exprValue.value; }
+
+#endif
+
+// Slots of the boxed ints, only used with CARP_NAN_BOXING. The vm frees the
+// unreachable ones, see collectBoxedInts() in vm.cpp, makeBoxedInt() reuses them.
+struct BoxedInts
+{
+    std::vector<i64> values;
+    std::vector<u32> freeSlots;
+    std::vector<bool> marks;
+    u32 liveCount;
+    u32 nextCollection;
+};
+
+#if CARP_NAN_BOXING
+// Whether enough boxes were made since the last collection.
+bool boxedInts_wantsCollection(const MyMemory& mem);
+// Begin marks mem.constants, the caller marks what it holds, then sweep.
+void boxedInts_beginCollection(MyMemory& mem);
+void boxedInts_mark(MyMemory& mem, Value v);
+void boxedInts_sweep(MyMemory& mem);
+#endif
+
+Value toValue(MyMemory& mem, const ExprValue& exprValue);
+ExprValue toExprValue(const MyMemory& mem, Value v);
@@ -0,0 +1,647 @@
+#include "vm.h"
+
+#include "astparser.h"
+#include "bytecode.h"
+#include "compiler.h"
+#include "errors.h"
+#include "expr.h"
+#include "helpers.h"
+#include "mymemory.h"
+#include "token.h"
+
+#include <assert.h>
+#include <string>
+#include <vector>
+
+// Computed goto is a GCC and Clang extension. CARP_SWITCH_DISPATCH builds the
+// portable switch loop only.
+#if (defined(__GNUC__) || defined(__clang__)) && !CARP_SWITCH_DISPATCH
+    #define CARP_THREADED_DISPATCH 1
+#else
+    #define CARP_THREADED_DISPATCH 0
+#endif
+
+static constexpr u32 StackMax = 16 * 1024;
+static constexpr u32 FramesMax = 1024;
+// Headroom for temporaries of a single frame, checked on every call.
+static constexpr u32 StackSlack = 256;
+
+struct VmCallFrame
+{
+    const u8* returnIp;
+    u32 savedLocalsBase;
+    u32 stackBase;
+};
+
+struct VM
+{
+    MyMemory& mem;
+    std::vector<Value> stack;
+    std::vector<Value> globals;
+    std::vector<VmCallFrame> frames;
+    u32 stackTop;
+    // Frame slot 0 of the running function, locals live on the value stack.
+    u32 localsBase;
+    // Code offsets of quickened ops whose guard failed, they stay generic.
+    std::vector<bool> deoptimized;
+};
+
+static void runtimeError(const VM& vm, const u8* ip, const std::string& message)
+{
+    // ip already points past the opcode that failed.
+    u32 offset = (u32)(ip - vm.mem.code.data()) - 1;
+    i32 line = offset < vm.mem.codeLines.size() ? vm.mem.codeLines[offset] : -1;
+    reportError(line, message, "at runtime");
+}
+
+static void undefinedGlobalError(const VM& vm, const u8* ip)
+{
+    u32 slot = readOperand(ip);
+    runtimeError(vm, ip, "Variable not found: '" + std::string(getSymbolName(vm.mem, vm.mem.globalNames[slot])) + "'");
+}
+
+static void push(VM& vm, Value value)
+{
+    vm.stack[vm.stackTop++] = value;
+}
+
+static Value pop(VM& vm)
+{
+    assert(vm.stackTop > 0);
+    return vm.stack[--vm.stackTop];
+}
+
+static Value& peek(VM& vm, u32 distance)
+{
+    return vm.stack[vm.stackTop - 1 - distance];
+}
+
+static u32 opOffset(const VM& vm, const u8* ip)
+{
+    // ip already points past the opcode.
+    return (u32)(ip - vm.mem.code.data()) - 1;
+}
+
+// Rewrites the op at ip into the form specialised for the operand types it just
+// saw, unless that form failed its guard there before.
+static void quicken(VM& vm, const u8* ip, OpCode quickOp)
+{
+    u32 offset = opOffset(vm, ip);
+    if(offset >= vm.deoptimized.size() || !vm.deoptimized[offset])
+    {
+        vm.mem.code[offset] = quickOp;
+    }
+}
+
+static void deoptimize(VM& vm, const u8* ip, OpCode genericOp)
+{
+    u32 offset = opOffset(vm, ip);
+    vm.mem.code[offset] = genericOp;
+    if(offset >= vm.deoptimized.size())
+    {
+        vm.deoptimized.resize(vm.mem.code.size());
+    }
+    vm.deoptimized[offset] = true;
+}
+
+// Runs at jumps and calls, between instructions every value the vm holds is
+// on its stack or in its globals. Loops and recursion pass one each round.
+static void collectBoxedInts([[maybe_unused]] VM& vm)
+{
+#if CARP_NAN_BOXING
+    MyMemory& mem = vm.mem;
+    if(!boxedInts_wantsCollection(mem))
+    {
+        return;
+    }
+    boxedInts_beginCollection(mem);
+    for(u32 i = 0; i < vm.stackTop; ++i)
+    {
+        boxedInts_mark(mem, vm.stack[i]);
+    }
+    for(Value global : vm.globals)
+    {
+        boxedInts_mark(mem, global);
+    }
+    boxedInts_sweep(mem);
+#endif
+}
+
+// Makes room for size more string bytes from an operation on left and right,
+// collecting first when the heap asks for it. Everything the vm holds is on
+// its stack or in its globals then, besides the operands.
+static bool reserveStrings(VM& vm, const u8* ip, u32 left, u32 right, u64 size)
+{
+    MyMemory& mem = vm.mem;
+    if(stringHeap_wantsCollection(mem, size))
+    {
+        stringHeap_beginCollection(mem);
+        stringHeap_mark(mem, left);
+        stringHeap_mark(mem, right);
+        for(u32 i = 0; i < vm.stackTop; ++i)
+        {
+            if(isString(vm.stack[i]))
+            {
+                stringHeap_mark(mem, asStringIndex(vm.stack[i]));
+            }
+        }
+        for(Value global : vm.globals)
+        {
+            if(isString(global))
+            {
+                stringHeap_mark(mem, asStringIndex(global));
+            }
+        }
+        stringHeap_sweep(mem);
+    }
+    if(!stringHeap_fits(mem, size))
+    {
+        runtimeError(vm, ip, "String heap limit exceeded!");
+        return false;
+    }
+    return true;
+}
+
+static bool concatStrings(VM& vm, const u8* ip, u32 left, u32 right, u32& outStringIndex)
+{
+    if(!reserveStrings(vm, ip, left, right, stringHeap_concatBytes(vm.mem, left, right)))
+    {
+        return false;
+    }
+    outStringIndex = stringHeap_concat(vm.mem, left, right);
+    return true;
+}
+
+static bool binaryOp(VM& vm, const u8* ip, TokenType type, OpCode intOp, OpCode doubleOp)
+{
+    MyMemory& mem = vm.mem;
+    Value rightValue = pop(vm);
+    Value& leftValue = peek(vm, 0);
+    if(isInt(leftValue) && isInt(rightValue))
+    {
+        quicken(vm, ip, intOp);
+        leftValue = toValue(mem, doIntOperOnBinary(type, asInt(mem, leftValue), asInt(mem, rightValue)));
+        return true;
+    }
+    else if(checkNumber(leftValue) && checkNumber(rightValue))
+    {
+        if(isDouble(leftValue) && isDouble(rightValue))
+        {
+            quicken(vm, ip, doubleOp);
+        }
+        leftValue = toValue(mem, doDoubleOperOnBinary(type, getDouble(mem, leftValue), getDouble(mem, rightValue)));
+        return true;
+    }
+    else if(checkString(leftValue) && checkString(rightValue))
+    {
+        if(type == TokenType::PLUS)
+        {
+            u32 stringIndex = 0;
+            if(!concatStrings(vm, ip, asStringIndex(leftValue), asStringIndex(rightValue), stringIndex))
+            {
+                return false;
+            }
+            leftValue = makeString(stringIndex);
+            return true;
+        }
+        // Comparing flattens ropes.
+        bool equalityOnly = type == TokenType::EQUAL_EQUAL || type == TokenType::BANG_EQUAL;
+        u32 left = asStringIndex(leftValue);
+        u32 right = asStringIndex(rightValue);
+        if(!reserveStrings(vm, ip, left, right, stringHeap_compareBytes(mem, left, right, equalityOnly)))
+        {
+            return false;
+        }
+        ExprValue value = doStringOperOnBinary(mem, type, left, right);
+        if(value.literalType == LiteralType_None)
+        {
+            runtimeError(vm, ip, "Strings only support + and comparisons");
+            return false;
+        }
+        leftValue = toValue(mem, value);
+        return true;
+    }
+    runtimeError(vm, ip, "Left and Right values aren't matching");
+    return false;
+}
+
+// Quickened int op, the guard falls back to the generic op for good.
+template <typename IntOp>
+static bool quickIntOp(VM& vm, const u8* ip, TokenType type, OpCode genericOp, IntOp intOp)
+{
+    Value rightValue = peek(vm, 0);
+    Value& leftValue = peek(vm, 1);
+    if(isInt(leftValue) && isInt(rightValue))
+    {
+        leftValue = intOp(asInt(vm.mem, leftValue), asInt(vm.mem, rightValue));
+        vm.stackTop--;
+        return true;
+    }
+    deoptimize(vm, ip, genericOp);
+    return binaryOp(vm, ip, type, genericOp, genericOp);
+}
+
+template <typename DoubleOp>
+static bool quickDoubleOp(VM& vm, const u8* ip, TokenType type, OpCode genericOp, DoubleOp doubleOp)
+{
+    Value rightValue = peek(vm, 0);
+    Value& leftValue = peek(vm, 1);
+    if(isDouble(leftValue) && isDouble(rightValue))
+    {
+        leftValue = doubleOp(asDouble(leftValue), asDouble(rightValue));
+        vm.stackTop--;
+        return true;
+    }
+    deoptimize(vm, ip, genericOp);
+    return binaryOp(vm, ip, type, genericOp, genericOp);
+}
+
+// Parses, resolves and compiles a skipped function body on its first call.
+// mem.code grows, ip and the saved return addresses move along with it.
+static bool loadFunction(VM& vm, u32 fnIndex, const u8*& code, const u8*& ip)
+{
+    MyMemory& mem = vm.mem;
+    if(!ast_parseFunction(mem, fnIndex))
+    {
+        runtimeError(vm, ip, "Failed to parse function!");
+        return false;
+    }
+    bool compiled = bytecode_compileFunction(mem, fnIndex);
+    const u8* newCode = mem.code.data();
+    for(VmCallFrame& frame : vm.frames)
+    {
+        frame.returnIp = newCode + (frame.returnIp - code);
+    }
+    ip = newCode + (ip - code);
+    code = newCode;
+    if(!compiled)
+    {
+        runtimeError(vm, ip, "Failed to compile function!");
+    }
+    return compiled;
+}
+
+// Threaded dispatch ends every handler with its own indirect jump to the next
+// one, through a table of label addresses. Each jump gets its own branch
+// history, the switch funnels all of them through a single jump.
+#if CARP_THREADED_DISPATCH
+#define VM_CASE(op) case op: Handler_##op:
+#define VM_NEXT() if constexpr(Threaded) { goto *handlers[*ip++]; } else { break; }
+#else
+#define VM_CASE(op) case op:
+#define VM_NEXT() break
+#endif
+
+template <bool Threaded>
+static bool execute(VM& vm, u32 entry)
+{
+    MyMemory& mem = vm.mem;
+    const u8* code = mem.code.data();
+    const u8* ip = code + entry;
+
+#if CARP_THREADED_DISPATCH
+    // Indexed by OpCode, in the order of the enum.
+    static void* const handlers[] = {
+        &&Handler_OpCode_Constant,
+        &&Handler_OpCode_Nil,
+        &&Handler_OpCode_True,
+        &&Handler_OpCode_False,
+        &&Handler_OpCode_Pop,
+        &&Handler_OpCode_GetGlobal,
+        &&Handler_OpCode_SetGlobal,
+        &&Handler_OpCode_DefineGlobal,
+        &&Handler_OpCode_GetLocal,
+        &&Handler_OpCode_SetLocal,
+        &&Handler_OpCode_DefineLocal,
+        &&Handler_OpCode_Add,
+        &&Handler_OpCode_Subtract,
+        &&Handler_OpCode_Multiply,
+        &&Handler_OpCode_Divide,
+        &&Handler_OpCode_Greater,
+        &&Handler_OpCode_GreaterEqual,
+        &&Handler_OpCode_Lesser,
+        &&Handler_OpCode_LesserEqual,
+        &&Handler_OpCode_Equal,
+        &&Handler_OpCode_NotEqual,
+        &&Handler_OpCode_AddInt,
+        &&Handler_OpCode_SubtractInt,
+        &&Handler_OpCode_MultiplyInt,
+        &&Handler_OpCode_DivideInt,
+        &&Handler_OpCode_GreaterInt,
+        &&Handler_OpCode_GreaterEqualInt,
+        &&Handler_OpCode_LesserInt,
+        &&Handler_OpCode_LesserEqualInt,
+        &&Handler_OpCode_EqualInt,
+        &&Handler_OpCode_NotEqualInt,
+        &&Handler_OpCode_AddDouble,
+        &&Handler_OpCode_SubtractDouble,
+        &&Handler_OpCode_MultiplyDouble,
+        &&Handler_OpCode_DivideDouble,
+        &&Handler_OpCode_GreaterDouble,
+        &&Handler_OpCode_GreaterEqualDouble,
+        &&Handler_OpCode_LesserDouble,
+        &&Handler_OpCode_LesserEqualDouble,
+        &&Handler_OpCode_EqualDouble,
+        &&Handler_OpCode_NotEqualDouble,
+        &&Handler_OpCode_Negate,
+        &&Handler_OpCode_Not,
+        &&Handler_OpCode_Print,
+        &&Handler_OpCode_Echo,
+        &&Handler_OpCode_Jump,
+        &&Handler_OpCode_JumpIfFalse,
+        &&Handler_OpCode_JumpIfTrue,
+        &&Handler_OpCode_Call,
+        &&Handler_OpCode_Return,
+        &&Handler_OpCode_Halt,
+    };
+    static_assert(sizeof(handlers) / sizeof(handlers[0]) == OpCode_Count);
+    if constexpr(Threaded)
+    {
+        goto *handlers[*ip++];
+    }
+#endif
+
+    for(;;)
+    {
+        switch((OpCode)*ip++)
+        {
+            VM_CASE(OpCode_Constant)
+            {
+                push(vm, mem.constants[readOperand(ip)]);
+                ip += sizeof(u32);
+            }
+            VM_NEXT();
+            VM_CASE(OpCode_Nil)
+                push(vm, makeNil());
+                VM_NEXT();
+            VM_CASE(OpCode_True)
+                push(vm, makeBool(true));
+                VM_NEXT();
+            VM_CASE(OpCode_False)
+                push(vm, makeBool(false));
+                VM_NEXT();
+            VM_CASE(OpCode_Pop)
+                pop(vm);
+                VM_NEXT();
+
+            VM_CASE(OpCode_GetGlobal)
+            {
+                Value value = vm.globals[readOperand(ip)];
+                if(isNone(value))
+                {
+                    undefinedGlobalError(vm, ip);
+                    return false;
+                }
+                push(vm, value);
+                ip += sizeof(u32);
+            }
+            VM_NEXT();
+            VM_CASE(OpCode_SetGlobal)
+            {
+                Value& value = vm.globals[readOperand(ip)];
+                if(isNone(value))
+                {
+                    undefinedGlobalError(vm, ip);
+                    return false;
+                }
+                value = peek(vm, 0);
+                ip += sizeof(u32);
+            }
+            VM_NEXT();
+            VM_CASE(OpCode_DefineGlobal)
+            {
+                vm.globals[readOperand(ip)] = pop(vm);
+                ip += sizeof(u32);
+            }
+            VM_NEXT();
+            VM_CASE(OpCode_GetLocal)
+            {
+                push(vm, vm.stack[vm.localsBase + readOperand(ip)]);
+                ip += sizeof(u32);
+            }
+            VM_NEXT();
+            VM_CASE(OpCode_SetLocal)
+            {
+                vm.stack[vm.localsBase + readOperand(ip)] = peek(vm, 0);
+                ip += sizeof(u32);
+            }
+            VM_NEXT();
+            VM_CASE(OpCode_DefineLocal)
+            {
+                vm.stack[vm.localsBase + readOperand(ip)] = pop(vm);
+                ip += sizeof(u32);
+            }
+            VM_NEXT();
+
+            VM_CASE(OpCode_Add) if(!binaryOp(vm, ip, TokenType::PLUS, OpCode_AddInt, OpCode_AddDouble)) return false; VM_NEXT();
+            VM_CASE(OpCode_Subtract) if(!binaryOp(vm, ip, TokenType::MINUS, OpCode_SubtractInt, OpCode_SubtractDouble)) return false; VM_NEXT();
+            VM_CASE(OpCode_Multiply) if(!binaryOp(vm, ip, TokenType::STAR, OpCode_MultiplyInt, OpCode_MultiplyDouble)) return false; VM_NEXT();
+            VM_CASE(OpCode_Divide) if(!binaryOp(vm, ip, TokenType::SLASH, OpCode_DivideInt, OpCode_DivideDouble)) return false; VM_NEXT();
+            VM_CASE(OpCode_Greater) if(!binaryOp(vm, ip, TokenType::GREATER, OpCode_GreaterInt, OpCode_GreaterDouble)) return false; VM_NEXT();
+            VM_CASE(OpCode_GreaterEqual) if(!binaryOp(vm, ip, TokenType::GREATER_EQUAL, OpCode_GreaterEqualInt, OpCode_GreaterEqualDouble)) return false; VM_NEXT();
+            VM_CASE(OpCode_Lesser) if(!binaryOp(vm, ip, TokenType::LESSER, OpCode_LesserInt, OpCode_LesserDouble)) return false; VM_NEXT();
+            VM_CASE(OpCode_LesserEqual) if(!binaryOp(vm, ip, TokenType::LESSER_EQUAL, OpCode_LesserEqualInt, OpCode_LesserEqualDouble)) return false; VM_NEXT();
+            VM_CASE(OpCode_Equal) if(!binaryOp(vm, ip, TokenType::EQUAL_EQUAL, OpCode_EqualInt, OpCode_EqualDouble)) return false; VM_NEXT();
+            VM_CASE(OpCode_NotEqual) if(!binaryOp(vm, ip, TokenType::BANG_EQUAL, OpCode_NotEqualInt, OpCode_NotEqualDouble)) return false; VM_NEXT();
+
+            VM_CASE(OpCode_AddInt) if(!quickIntOp(vm, ip, TokenType::PLUS, OpCode_Add, [&mem](i64 a, i64 b) { return makeInt(mem, a + b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_SubtractInt) if(!quickIntOp(vm, ip, TokenType::MINUS, OpCode_Subtract, [&mem](i64 a, i64 b) { return makeInt(mem, a - b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_MultiplyInt) if(!quickIntOp(vm, ip, TokenType::STAR, OpCode_Multiply, [&mem](i64 a, i64 b) { return makeInt(mem, a * b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_DivideInt) if(!quickIntOp(vm, ip, TokenType::SLASH, OpCode_Divide, [&mem](i64 a, i64 b) { return makeInt(mem, a / b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_GreaterInt) if(!quickIntOp(vm, ip, TokenType::GREATER, OpCode_Greater, [](i64 a, i64 b) { return makeBool(a > b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_GreaterEqualInt) if(!quickIntOp(vm, ip, TokenType::GREATER_EQUAL, OpCode_GreaterEqual, [](i64 a, i64 b) { return makeBool(a >= b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_LesserInt) if(!quickIntOp(vm, ip, TokenType::LESSER, OpCode_Lesser, [](i64 a, i64 b) { return makeBool(a < b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_LesserEqualInt) if(!quickIntOp(vm, ip, TokenType::LESSER_EQUAL, OpCode_LesserEqual, [](i64 a, i64 b) { return makeBool(a <= b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_EqualInt) if(!quickIntOp(vm, ip, TokenType::EQUAL_EQUAL, OpCode_Equal, [](i64 a, i64 b) { return makeBool(a == b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_NotEqualInt) if(!quickIntOp(vm, ip, TokenType::BANG_EQUAL, OpCode_NotEqual, [](i64 a, i64 b) { return makeBool(a != b); })) return false; VM_NEXT();
+
+            VM_CASE(OpCode_AddDouble) if(!quickDoubleOp(vm, ip, TokenType::PLUS, OpCode_Add, [](double a, double b) { return makeDouble(a + b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_SubtractDouble) if(!quickDoubleOp(vm, ip, TokenType::MINUS, OpCode_Subtract, [](double a, double b) { return makeDouble(a - b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_MultiplyDouble) if(!quickDoubleOp(vm, ip, TokenType::STAR, OpCode_Multiply, [](double a, double b) { return makeDouble(a * b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_DivideDouble) if(!quickDoubleOp(vm, ip, TokenType::SLASH, OpCode_Divide, [](double a, double b) { return makeDouble(a / b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_GreaterDouble) if(!quickDoubleOp(vm, ip, TokenType::GREATER, OpCode_Greater, [](double a, double b) { return makeBool(a > b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_GreaterEqualDouble) if(!quickDoubleOp(vm, ip, TokenType::GREATER_EQUAL, OpCode_GreaterEqual, [](double a, double b) { return makeBool(a >= b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_LesserDouble) if(!quickDoubleOp(vm, ip, TokenType::LESSER, OpCode_Lesser, [](double a, double b) { return makeBool(a < b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_LesserEqualDouble) if(!quickDoubleOp(vm, ip, TokenType::LESSER_EQUAL, OpCode_LesserEqual, [](double a, double b) { return makeBool(a <= b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_EqualDouble) if(!quickDoubleOp(vm, ip, TokenType::EQUAL_EQUAL, OpCode_Equal, [](double a, double b) { return makeBool(a == b); })) return false; VM_NEXT();
+            VM_CASE(OpCode_NotEqualDouble) if(!quickDoubleOp(vm, ip, TokenType::BANG_EQUAL, OpCode_NotEqual, [](double a, double b) { return makeBool(a != b); })) return false; VM_NEXT();
+
+            VM_CASE(OpCode_Negate)
+            {
+                Value& value = peek(vm, 0);
+                if(isInt(value))
+                {
+                    value = makeInt(mem, -asInt(mem, value));
+                }
+                else if(isDouble(value))
+                {
+                    value = makeDouble(-asDouble(value));
+                }
+                else
+                {
+                    runtimeError(vm, ip, "Unary not number");
+                    return false;
+                }
+            }
+            VM_NEXT();
+            VM_CASE(OpCode_Not)
+            {
+                Value& value = peek(vm, 0);
+                value = makeBool(!isTruthy(mem, value));
+            }
+            VM_NEXT();
+
+            VM_CASE(OpCode_Print)
+            {
+                printValue(mem, pop(vm));
+            }
+            VM_NEXT();
+            VM_CASE(OpCode_Echo)
+            {
+                Value value = pop(vm);
+                if(!isNone(value))
+                {
+                    printValue(mem, value);
+                }
+            }
+            VM_NEXT();
+
+            VM_CASE(OpCode_Jump)
+            {
+                collectBoxedInts(vm);
+                ip = code + readOperand(ip);
+            }
+            VM_NEXT();
+            VM_CASE(OpCode_JumpIfFalse)
+            {
+                if(!isTruthy(mem, peek(vm, 0)))
+                    ip = code + readOperand(ip);
+                else
+                    ip += sizeof(u32);
+            }
+            VM_NEXT();
+            VM_CASE(OpCode_JumpIfTrue)
+            {
+                if(isTruthy(mem, peek(vm, 0)))
+                    ip = code + readOperand(ip);
+                else
+                    ip += sizeof(u32);
+            }
+            VM_NEXT();
+
+            VM_CASE(OpCode_Call)
+            {
+                collectBoxedInts(vm);
+                u32 argCount = readOperand(ip);
+                ip += sizeof(u32);
+
+                Value calleeValue = peek(vm, argCount);
+                if(!isFunction(calleeValue))
+                {
+                    runtimeError(vm, ip, "Can only call functions!");
+                    return false;
+                }
+                u32 fnIndex = asFunctionIndex(calleeValue);
+                const Statement& statement = mem.functions[fnIndex];
+                if(argCount != statement.paramsCount)
+                {
+                    runtimeError(vm, ip, "Wrong amount of arguments!");
+                    return false;
+                }
+                if(mem.functionEntries[fnIndex] == ~0u && !loadFunction(vm, fnIndex, code, ip))
+                {
+                    return false;
+                }
+                if(vm.frames.size() >= FramesMax || vm.stackTop - argCount + statement.localSlotCount + StackSlack >= StackMax)
+                {
+                    runtimeError(vm, ip, "Stack overflow!");
+                    return false;
+                }
+
+                // Arguments already sit in the first slots, reserve the rest for locals.
+                u32 stackBase = vm.stackTop - argCount - 1;
+                vm.frames.push_back(VmCallFrame{
+                    .returnIp = ip,
+                    .savedLocalsBase = vm.localsBase,
+                    .stackBase = stackBase
+                });
+                ip = code + mem.functionEntries[fnIndex];
+                vm.localsBase = stackBase + 1;
+                vm.stackTop = vm.localsBase + statement.localSlotCount;
+            }
+            VM_NEXT();
+            VM_CASE(OpCode_Return)
+            {
+                Value value = pop(vm);
+                const VmCallFrame& frame = vm.frames.back();
+                ip = frame.returnIp;
+                vm.localsBase = frame.savedLocalsBase;
+                vm.stackTop = frame.stackBase;
+                vm.frames.pop_back();
+                push(vm, value);
+            }
+            VM_NEXT();
+
+            VM_CASE(OpCode_Halt)
+                return true;
+
+            case OpCode_Count:
+            default:
+            {
+                runtimeError(vm, ip, "Unknown opcode!");
+                return false;
+            }
+        }
+    }
+}
+
+#undef VM_CASE
+#undef VM_NEXT
+
+static bool run(MyMemory& mem, u32 entry, VmDispatch dispatch)
+{
+    VM vm{.mem = mem, .stackTop = 0, .localsBase = 0 };
+    vm.stack.resize(StackMax);
+    vm.frames.reserve(FramesMax);
+
+    for(const ExprValue& global : mem.globals)
+    {
+        vm.globals.push_back(toValue(mem, global));
+    }
+
+    // Locals of top-level blocks.
+    vm.stackTop = mem.scriptLocalCount;
+
+#if CARP_THREADED_DISPATCH
+    bool result = dispatch == VmDispatch_Switch ? execute<false>(vm, entry) : execute<true>(vm, entry);
+#else
+    bool result = execute<false>(vm, entry);
+#endif
+
+    // Globals outlive the run, also when it stopped on an error.
+    for(u32 slot = 0; slot < vm.globals.size(); ++slot)
+    {
+        mem.globals[slot] = toExprValue(mem, vm.globals[slot]);
+    }
+    return result;
+}
+
+bool vm_run(MyMemory& mem)
+{
+    return run(mem, 0, VmDispatch_Default);
+}
+
+bool vm_runFrom(MyMemory& mem, u32 entry)
+{
+    return run(mem, entry, VmDispatch_Default);
+}
+
+bool vm_runWith(MyMemory& mem, VmDispatch dispatch)
+{
+    return run(mem, 0, dispatch);
+}
+
+bool vm_threadedDispatch()
+{
+    return CARP_THREADED_DISPATCH;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "mytypes.h"
+
+struct MyMemory;
+
+enum VmDispatch : u8
+{
+    // Threaded with compilers that have labels as values, the switch otherwise.
+    VmDispatch_Default,
+    VmDispatch_Switch,
+};
+
+// Runs the bytecode produced by bytecode_compile().
+bool vm_run(MyMemory& mem);
+// Runs from a code offset up to the next halt, see bytecode_compileMore().
+// mem.globals holds the values the globals had when the run ended.
+bool vm_runFrom(MyMemory& mem, u32 entry);
+// Runs the whole program with the given dispatch loop, for --bench-dispatch.
+bool vm_runWith(MyMemory& mem, VmDispatch dispatch);
+// Whether VmDispatch_Default is the threaded loop in this build.
+bool vm_threadedDispatch();
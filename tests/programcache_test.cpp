@@ -0,0 +1,142 @@
+// Loads damaged program caches, every one has to be a miss that leaves mem empty.
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "../src/astparser.h"
+#include "../src/mymemory.h"
+#include "../src/optimizer.h"
+#include "../src/programcache.h"
+#include "../src/sourcefile.h"
+
+static const char* ScriptPath = "programcache_test.carp";
+static const char* Script =
+    "fn add(a, b)\n"
+    "{\n"
+    "    return a + b;\n"
+    "}\n"
+    "var tag = \"circle\";\n"
+    "var i = 0;\n"
+    "while (i < 10)\n"
+    "{\n"
+    "    if (tag == \"circle\") i = add(i, 1);\n"
+    "}\n"
+    "print i * 2.5;\n";
+
+static bool writeFile(const char* path, const std::vector<u8>& bytes)
+{
+    FILE* file = fopen(path, "wb");
+    if(file == nullptr)
+    {
+        return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && ok;
+}
+
+static bool readFile(const char* path, std::vector<u8>& bytes)
+{
+    FILE* file = fopen(path, "rb");
+    if(file == nullptr)
+    {
+        return false;
+    }
+    u8 buffer[4096];
+    size_t count = 0;
+    while((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        bytes.insert(bytes.end(), buffer, buffer + count);
+    }
+    fclose(file);
+    return true;
+}
+
+// Loads with the script open like runFile() does.
+static bool loadCache(const char* cachePath, u32& expressionCount)
+{
+    MyMemory mem{};
+    if(!sourceFile_open(mem.source, ScriptPath))
+    {
+        return false;
+    }
+    bool loaded = programCache_load(mem, cachePath, 1, false);
+    expressionCount = mem.expressions.size();
+    sourceFile_close(mem.source);
+    return loaded;
+}
+
+int main()
+{
+    std::vector<u8> script((const u8*)Script, (const u8*)Script + std::string(Script).size());
+    std::string cachePath = programCache_path(ScriptPath, 1, false);
+    if(!writeFile(ScriptPath, script))
+    {
+        printf("FAIL: cannot write %s\n", ScriptPath);
+        return 1;
+    }
+
+    MyMemory mem{};
+    mem.optLevel = 1;
+    if(!sourceFile_open(mem.source, ScriptPath) || !ast_generate(mem, 1, false))
+    {
+        printf("FAIL: cannot parse %s\n", ScriptPath);
+        return 1;
+    }
+    optimizer_run(mem, 0);
+    u32 parsedExpressions = mem.expressions.size();
+    bool saved = programCache_save(mem, cachePath.c_str(), 1, false);
+    sourceFile_close(mem.source);
+
+    std::vector<u8> cache;
+    if(!saved || !readFile(cachePath.c_str(), cache))
+    {
+        printf("FAIL: cannot save %s\n", cachePath.c_str());
+        return 1;
+    }
+
+    u32 failures = 0;
+    u32 expressionCount = 0;
+    if(!loadCache(cachePath.c_str(), expressionCount) || expressionCount != parsedExpressions)
+    {
+        printf("FAIL: intact cache is not a hit\n");
+        failures++;
+    }
+
+    // Every byte of the header and a spread over the payload.
+    std::vector<u32> offsets;
+    for(u32 offset = 0; offset < cache.size(); offset += offset < 64 ? 1 : 7)
+    {
+        offsets.push_back(offset);
+    }
+    u32 tested = 0;
+    for(u32 offset : offsets)
+    {
+        std::vector<u8> damaged = cache;
+        damaged[offset] ^= 0x5a;
+        if(!writeFile(cachePath.c_str(), damaged))
+        {
+            printf("FAIL: cannot write %s\n", cachePath.c_str());
+            return 1;
+        }
+        tested++;
+        if(loadCache(cachePath.c_str(), expressionCount) || expressionCount != 0)
+        {
+            printf("FAIL: byte %u damaged still loads\n", offset);
+            failures++;
+        }
+    }
+
+    std::vector<u8> truncated(cache.begin(), cache.end() - cache.size() / 3);
+    if(!writeFile(cachePath.c_str(), truncated) || loadCache(cachePath.c_str(), expressionCount) || expressionCount != 0)
+    {
+        printf("FAIL: truncated cache still loads\n");
+        failures++;
+    }
+
+    remove(cachePath.c_str());
+    remove(ScriptPath);
+    printf("%u damaged caches tested, %u failures\n", tested + 1, failures);
+    return failures == 0 ? 0 : 1;
+}